@@ -1,8 +1,12 @@
 #include <cstdio>
 #include <chrono>
 #include <iostream>
+#include <mutex>
+#include <queue>
 #include <random>
+#include <thread>
 #include <benpm/mempool.hpp>
+#include <benpm/mpmc_queue.hpp>
 
 struct Item {
     std::string name;
@@ -261,6 +265,67 @@ Times testMem() {
     return times;
 }
 
+// Passes QN items from QThreads producers to QThreads consumers through a
+// queue with enqueue(size_t) and dequeue(size_t&), returns the time taken
+constexpr size_t QN = 4000000;
+constexpr size_t QThreads = 4;
+
+template <class Queue>
+int64_t testQueue(Queue& queue) {
+    std::chrono::high_resolution_clock clock;
+    std::atomic<size_t> consumed(0);
+    std::atomic<size_t> sum(0);
+    std::vector<std::thread> threads;
+    auto t = clock.now();
+    for (size_t p = 0; p < QThreads; p++) {
+        threads.emplace_back([&queue, p]() {
+            for (size_t i = p; i < QN; i += QThreads) {
+                queue.enqueue(i);
+            }
+        });
+    }
+    for (size_t c = 0; c < QThreads; c++) {
+        threads.emplace_back([&queue, &consumed, &sum]() {
+            size_t local = 0;
+            size_t v;
+            while (consumed.load(std::memory_order_relaxed) < QN) {
+                if (queue.dequeue(v)) {
+                    local += v;
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            sum += local;
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (sum != QN * (QN - 1) / 2) {
+        std::cout << "Queue sum is " << sum << " instead of " << QN * (QN - 1) / 2 << std::endl;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(clock.now() - t).count();
+}
+
+// std::queue behind a mutex, allocating through the system allocator
+struct MutexQueue {
+    std::mutex mutex;
+    std::queue<size_t> queue;
+
+    void enqueue(size_t v) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push(v);
+    }
+    bool dequeue(size_t& v) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.empty()) {
+            return false;
+        }
+        v = queue.front();
+        queue.pop();
+        return true;
+    }
+};
+
 
 int main(int argc, char const *argv[]) {
     Times t_rawPool = testMemPool();
@@ -286,5 +351,21 @@ int main(int argc, char const *argv[]) {
         std::string l = "(shared) " + std::string(labels[i]);
         printf("| %-28s | %9ldms | %12ldms |\n", l.c_str(), t_sharedPool[i], t_sharedNorm[i]);
     }
+    int64_t t_queuePool;
+    int64_t t_queueMutex;
+    {
+        MemPool<> pool;
+        MPMCQueue<size_t> queue(pool);
+        t_queuePool = testQueue(queue);
+    }
+    {
+        MutexQueue queue;
+        t_queueMutex = testQueue(queue);
+    }
+    std::string q = "queue (" + std::to_string(QThreads) + " producers, " + std::to_string(QThreads) + " consumers)";
+    printf("\n| %-35s | time     |\n", q.c_str());
+    printf("| ----------------------------------- | -------- |\n");
+    printf("| %-35s | %6ldms |\n", "lock-free MPMCQueue (pool nodes)", t_queuePool);
+    printf("| %-35s | %6ldms |\n", "std::queue + std::mutex", t_queueMutex);
     return 0;
 }
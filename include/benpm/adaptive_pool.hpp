@@ -0,0 +1,221 @@
+#pragma once
+
+#include "pool_router.hpp"
+
+namespace benpm {
+  /**
+   * @brief Memory pool that adapts the chunk size it carves for each size class
+   * to the observed workload
+   *
+   * Allocations are grouped into size classes by power of 2. Every class starts
+   * out in the pool PoolRouter would pick, and at the end of each epoch moves at
+   * most one chunk size up or down:
+   * - Up, when the class churns through (allocates and frees) at least a full
+   *   chunk of the next size per epoch and that size's chunks are recycling, so
+   *   hot classes refill less often and waste fewer chunk tails.
+   * - Down, when churning through a chunk of the current size takes more than
+   *   four epochs, so rare classes do not keep large, mostly empty chunks alive.
+   * Chunk sizes whose tail waste exceeds an eighth of the chunk for the class's
+   * mean object size are skipped. Since all pools share one blockSize, objects
+   * are freed correctly from whichever pool their class used at the time.
+   *
+   * @tparam blockSize Size in bytes of blocks in every pool. Must be a power of 2!
+   * @tparam chunkSizes Chunk sizes to choose from, ascending. Must be powers of 2!
+   */
+  template <size_t blockSize, size_t... chunkSizes>
+  class AdaptivePool {
+  private:  // ------------------------------------------------------------
+    using Router = PoolRouter<blockSize, chunkSizes...>;
+    static constexpr size_t numPools = Router::numPools;
+    static constexpr size_t numClasses = 65;
+
+    struct SizeClass {
+      size_t allocs = 0;  // Allocations in the current epoch
+      size_t frees = 0;   // Frees in the current epoch
+      size_t bytes = 0;   // Bytes allocated in the current epoch
+      size_t mean = 0;    // Mean object size, as of the last epoch with allocations
+      size_t pool = 0;    // Pool currently carving chunks for this class
+    };
+
+    Router router;
+    SizeClass classes[numClasses];
+    // Allocations since the start of the epoch
+    size_t epochAllocs = 0;
+    // Pool counters at the start of the epoch
+    PoolStats epochStats[numPools];
+    // Mutex for thread safety
+    mutable std::mutex mutex;
+
+    // Returns true if pool p is a sensible home for objects of class c with
+    // given mean size: they fit, enough of them fit, and the tail is small
+    static bool suits(size_t p, size_t c, size_t mean) {
+      const size_t cs = Router::chunkSizeOf(p);
+      if (c < 64 && ((size_t)1 << c) > cs) {
+        return false;
+      }
+      return (p + 1 == numPools || cs / mean >= Router::minSlots) && (cs % mean) * 8 <= cs;
+    }
+
+    // Moves every size class at most one chunk size up or down and starts a
+    // new epoch. Must be called with the mutex held
+    void adapt() {
+      bool recycling[numPools];
+      for (size_t p = 0; p < numPools; p++) {
+        const PoolStats now = this->router.getStats(p);
+        const size_t taken = now.chunksTaken - this->epochStats[p].chunksTaken;
+        const size_t recycled = now.chunksRecycled - this->epochStats[p].chunksRecycled;
+        recycling[p] = taken == 0 || recycled * 2 >= taken;
+        this->epochStats[p] = now;
+      }
+      for (size_t c = 0; c < numClasses; c++) {
+        SizeClass& sc = this->classes[c];
+        if (sc.allocs > 0) {
+          sc.mean = sc.bytes / sc.allocs;
+        }
+        const size_t mean = sc.mean;
+        if (mean > 0) {
+          const size_t cur = sc.pool;
+          // Objects turned over per epoch, averaging allocations and frees
+          const size_t churn = (sc.allocs + sc.frees) / 2;
+          if (cur + 1 < numPools && suits(cur + 1, c, mean) && recycling[cur + 1] &&
+              churn >= Router::chunkSizeOf(cur + 1) / mean) {
+            sc.pool = cur + 1;
+          } else if (cur > 0 && suits(cur - 1, c, mean) && churn * 4 < Router::chunkSizeOf(cur) / mean) {
+            sc.pool = cur - 1;
+          } else if (!suits(cur, c, mean)) {
+            for (size_t p = cur + 1; p < numPools; p++) {
+              if (suits(p, c, mean)) {
+                sc.pool = p;
+                break;
+              }
+            }
+          }
+        }
+        sc.allocs = 0;
+        sc.frees = 0;
+        sc.bytes = 0;
+      }
+      this->epochAllocs = 0;
+    }
+
+    // Records an allocation and returns the pool to carve it from
+    size_t onAllocate(size_t size) {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(this->mutex);
+      #endif
+      SizeClass& sc = this->classes[Router::ceilLog2(size)];
+      sc.allocs++;
+      sc.bytes += size;
+      if (++this->epochAllocs == epochLength) {
+        this->adapt();
+      }
+      return sc.pool;
+    }
+
+    // Records a free
+    void onFree(size_t size) {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(this->mutex);
+      #endif
+      this->classes[Router::ceilLog2(size)].frees++;
+    }
+
+  public:  // ------------------------------------------------------------
+    // Number of allocations per epoch
+    static constexpr size_t epochLength = 1 << 14;
+
+    AdaptivePool() {
+      for (size_t c = 0; c < numClasses; c++) {
+        this->classes[c].pool = Router::poolFor(c < 64 ? (size_t)1 << c : SIZE_MAX);
+      }
+    }
+
+    /**
+     * @brief Allocates object, returns pointer to object
+     *
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object
+     */
+    template <class T, class... V>
+    T* make(V&&... v) {
+      static_assert(allocSize<T>() <= Router::chunkSizeOf(numPools - 1), "Object is too large for the largest chunk size");
+      void* ptr = this->router.allocateIn(this->onAllocate(allocSize<T>()), allocSize<T>(), allocAlign<T>());
+      try {
+        return new (ptr) T(std::forward<V>(v)...);
+      } catch (...) {
+        this->router.deallocate(ptr, allocSize<T>());
+        throw;
+      }
+    }
+
+    /**
+     * @brief Allocates object, returns shared_ptr to object
+     *
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return std::shared_ptr<T> The allocated object
+     */
+    template <class T, class... V>
+    std::shared_ptr<T> makeShared(V&&... v) {
+      return std::shared_ptr<T>(this->make<T>(std::forward<V>(v)...), [this](T* o) { this->free(o); });
+    }
+
+    /**
+     * @brief Frees object from the pool that owns it
+     *
+     * @tparam T Object type
+     * @param obj Pointer to object that was alloc'd in this pool
+     */
+    template <class T>
+    void free(T* obj) {
+      this->onFree(allocSize<T>());
+      this->router.free(obj);
+    }
+
+    /**
+     * @brief Allocates uninitialized memory
+     *
+     * @param size Number of bytes to allocate
+     * @param align Alignment of the memory, a power of 2
+     * @return void* The allocated memory
+     * @throws std::bad_alloc If size exceeds the largest chunk size
+     */
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+      return this->router.allocateIn(this->onAllocate(size), size, align);
+    }
+
+    /**
+     * @brief Frees memory returned by allocate
+     *
+     * @param ptr Pointer to memory that was allocated in this pool
+     * @param size Number of bytes that were allocated
+     */
+    void deallocate(void* ptr, size_t size) {
+      this->onFree(size);
+      this->router.deallocate(ptr, size);
+    }
+
+    /**
+     * @brief Returns the chunk size currently carved for allocations of given
+     * size
+     */
+    size_t chunkSizeFor(size_t size) const {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(this->mutex);
+      #endif
+      return Router::chunkSizeOf(this->classes[Router::ceilLog2(size)].pool);
+    }
+
+    /**
+     * @brief Returns the number of blocks allocated across all chunk sizes
+     *
+     * @return size_t
+     */
+    size_t getNumBlocks() const {
+      return this->router.getNumBlocks();
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,492 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief Ordered map stored as a B+-tree whose nodes are allocated in a
+   * memory pool
+   *
+   * Every node takes nodeBytes, a fraction of the pool's chunk size, so a
+   * chunk holds several nodes and a node spans a handful of cache lines.
+   * Leaves store keys and values in separate arrays, binary searched by key,
+   * and are linked in order, so range scans stream from leaf to leaf without
+   * going back up the tree. bulkLoad builds a tree bottom-up from sorted
+   * input with full leaves.
+   *
+   * Erasing never rebalances: a leaf is only freed once it is empty, and
+   * inner nodes once they lose their last child. This keeps erase cheap at
+   * the cost of sparser nodes under heavy deletion.
+   *
+   * The map is not thread-safe.
+   *
+   * @tparam K Key type
+   * @tparam V Value type
+   * @tparam Compare Strict weak ordering of keys
+   * @tparam Pool The memory pool type nodes are allocated in
+   * @tparam nodeBytes Size in bytes of a node, at most the pool's chunk size
+   */
+  template <class K, class V, class Compare = std::less<K>, class Pool = MemPool<>,
+            size_t nodeBytes = Pool::getChunkSize() / 8>
+  class BTreeMap {
+  private:  // ------------------------------------------------------------
+    struct Node {
+      bool leaf;
+      uint16_t n;  // Number of keys
+    };
+
+    // Room left for node headers and padding
+    static constexpr size_t slack = 3 * sizeof(void*) + alignof(K) + alignof(V);
+
+  public:  // ------------------------------------------------------------
+    // Entries per leaf
+    static constexpr size_t leafCapacity = (nodeBytes - slack) / (sizeof(K) + sizeof(V));
+    // Keys per inner node, which has one more child than keys
+    static constexpr size_t innerCapacity = (nodeBytes - slack - sizeof(Node*)) / (sizeof(K) + sizeof(Node*));
+
+  private:  // ------------------------------------------------------------
+    static_assert(nodeBytes > slack, "nodeBytes is too small");
+    static_assert(nodeBytes <= Pool::getChunkSize(), "Nodes must fit in the pool's chunks");
+    static_assert(leafCapacity >= 4 && innerCapacity >= 4, "nodeBytes is too small for keys and values of this size");
+    static_assert(leafCapacity <= UINT16_MAX && innerCapacity <= UINT16_MAX, "nodeBytes is too large");
+
+    struct Leaf : Node {
+      Leaf* prev;
+      Leaf* next;
+      alignas(K) unsigned char keyBytes[leafCapacity * sizeof(K)];
+      alignas(V) unsigned char valueBytes[leafCapacity * sizeof(V)];
+
+      // Leaves the arrays uninitialized instead of zeroing them
+      Leaf() : Node{true, 0}, prev(nullptr), next(nullptr) {}
+      K* keys() { return (K*)this->keyBytes; }
+      V* values() { return (V*)this->valueBytes; }
+    };
+
+    struct Inner : Node {
+      Node* children[innerCapacity + 1];
+      alignas(K) unsigned char keyBytes[innerCapacity * sizeof(K)];
+
+      Inner() : Node{false, 0} {}
+      K* keys() { return (K*)this->keyBytes; }
+    };
+
+    static_assert(sizeof(Leaf) <= nodeBytes && sizeof(Inner) <= nodeBytes, "Node headers exceed the slack");
+
+    Pool& pool;
+    Compare less;
+    Node* root;
+    // Leftmost leaf
+    Leaf* first;
+    size_t count = 0;
+
+    // Moves n objects from src to dst, either of which may overlap
+    template <class T>
+    static void moveRange(T* dst, T* src, size_t n) {
+      if (dst < src) {
+        for (size_t i = 0; i < n; i++) {
+          new (&dst[i]) T(std::move(src[i]));
+          src[i].~T();
+        }
+      } else {
+        for (size_t i = n; i-- > 0;) {
+          new (&dst[i]) T(std::move(src[i]));
+          src[i].~T();
+        }
+      }
+    }
+
+    // Returns the index of the first key not less than key
+    size_t lowerIndex(const K* keys, size_t n, const K& key) const {
+      return (size_t)(std::lower_bound(keys, keys + n, key, this->less) - keys);
+    }
+
+    // Returns the index of the child of an inner node that key belongs in
+    size_t childIndex(Inner* inner, const K& key) const {
+      return (size_t)(std::upper_bound(inner->keys(), inner->keys() + inner->n, key, this->less) - inner->keys());
+    }
+
+    bool equal(const K& a, const K& b) const {
+      return !this->less(a, b) && !this->less(b, a);
+    }
+
+    Leaf* newLeaf() { return this->pool.template make<Leaf>(); }
+    Inner* newInner() { return this->pool.template make<Inner>(); }
+
+    // Destructs the entries of a node and its subtree, freeing all nodes
+    void destroy(Node* node) {
+      if (node->leaf) {
+        Leaf* leaf = (Leaf*)node;
+        for (size_t i = 0; i < leaf->n; i++) {
+          leaf->keys()[i].~K();
+          leaf->values()[i].~V();
+        }
+        this->pool.free(leaf);
+      } else {
+        Inner* inner = (Inner*)node;
+        for (size_t i = 0; i < inner->n; i++) {
+          inner->keys()[i].~K();
+        }
+        for (size_t i = 0; i <= inner->n; i++) {
+          this->destroy(inner->children[i]);
+        }
+        this->pool.free(inner);
+      }
+    }
+
+    // Inserts key and value below node unless key is present. If node
+    // splits, returns the new right sibling and sets sep to its lowest key
+    template <class KK, class VV>
+    Node* insert(Node* node, KK&& key, VV&& value, std::optional<K>& sep, bool& inserted) {
+      if (node->leaf) {
+        Leaf* leaf = (Leaf*)node;
+        size_t i = this->lowerIndex(leaf->keys(), leaf->n, key);
+        if (i < leaf->n && this->equal(leaf->keys()[i], key)) {
+          inserted = false;
+          return nullptr;
+        }
+        Leaf* right = nullptr;
+        if (leaf->n == leafCapacity) {
+          right = this->newLeaf();
+          const size_t mid = leaf->n / 2;
+          moveRange(right->keys(), leaf->keys() + mid, leaf->n - mid);
+          moveRange(right->values(), leaf->values() + mid, leaf->n - mid);
+          right->n = (uint16_t)(leaf->n - mid);
+          leaf->n = (uint16_t)mid;
+          right->prev = leaf;
+          right->next = leaf->next;
+          if (leaf->next != nullptr) {
+            leaf->next->prev = right;
+          }
+          leaf->next = right;
+          if (i > mid) {
+            leaf = right;
+            i -= mid;
+          }
+        }
+        moveRange(leaf->keys() + i + 1, leaf->keys() + i, leaf->n - i);
+        moveRange(leaf->values() + i + 1, leaf->values() + i, leaf->n - i);
+        new (&leaf->keys()[i]) K(std::forward<KK>(key));
+        new (&leaf->values()[i]) V(std::forward<VV>(value));
+        leaf->n++;
+        inserted = true;
+        if (right != nullptr) {
+          sep.emplace(right->keys()[0]);
+        }
+        return right;
+      }
+      Inner* inner = (Inner*)node;
+      size_t c = this->childIndex(inner, key);
+      std::optional<K> childSep;
+      Node* childRight = this->insert(inner->children[c], std::forward<KK>(key), std::forward<VV>(value), childSep, inserted);
+      if (childRight == nullptr) {
+        return nullptr;
+      }
+      Inner* right = nullptr;
+      if (inner->n == innerCapacity) {
+        right = this->newInner();
+        const size_t mid = inner->n / 2;
+        sep.emplace(std::move(inner->keys()[mid]));
+        inner->keys()[mid].~K();
+        moveRange(right->keys(), inner->keys() + mid + 1, inner->n - mid - 1);
+        std::copy(inner->children + mid + 1, inner->children + inner->n + 1, right->children);
+        right->n = (uint16_t)(inner->n - mid - 1);
+        inner->n = (uint16_t)mid;
+        if (c > mid) {
+          inner = right;
+          c -= mid + 1;
+        }
+      }
+      moveRange(inner->keys() + c + 1, inner->keys() + c, inner->n - c);
+      std::copy_backward(inner->children + c + 1, inner->children + inner->n + 1, inner->children + inner->n + 2);
+      new (&inner->keys()[c]) K(std::move(*childSep));
+      inner->children[c + 1] = childRight;
+      inner->n++;
+      return right;
+    }
+
+    // Erases key below node. Sets emptied if node lost its last entry or
+    // child, in which case the caller frees it
+    bool erase(Node* node, const K& key, bool& emptied) {
+      if (node->leaf) {
+        Leaf* leaf = (Leaf*)node;
+        const size_t i = this->lowerIndex(leaf->keys(), leaf->n, key);
+        if (i == leaf->n || !this->equal(leaf->keys()[i], key)) {
+          return false;
+        }
+        leaf->keys()[i].~K();
+        leaf->values()[i].~V();
+        moveRange(leaf->keys() + i, leaf->keys() + i + 1, leaf->n - i - 1);
+        moveRange(leaf->values() + i, leaf->values() + i + 1, leaf->n - i - 1);
+        leaf->n--;
+        emptied = leaf->n == 0;
+        return true;
+      }
+      Inner* inner = (Inner*)node;
+      const size_t c = this->childIndex(inner, key);
+      Node* child = inner->children[c];
+      bool childEmptied = false;
+      if (!this->erase(child, key, childEmptied)) {
+        return false;
+      }
+      if (childEmptied) {
+        this->freeEmpty(child);
+        if (inner->n == 0) {
+          emptied = true;
+          return true;
+        }
+        // Drop the separator on the side of the removed child
+        const size_t k = c > 0 ? c - 1 : 0;
+        inner->keys()[k].~K();
+        moveRange(inner->keys() + k, inner->keys() + k + 1, inner->n - k - 1);
+        std::copy(inner->children + c + 1, inner->children + inner->n + 1, inner->children + c);
+        inner->n--;
+      }
+      return true;
+    }
+
+    // Frees a node that erase emptied, unlinking it if it is a leaf
+    void freeEmpty(Node* node) {
+      if (node->leaf) {
+        Leaf* leaf = (Leaf*)node;
+        if (leaf->prev != nullptr) {
+          leaf->prev->next = leaf->next;
+        } else {
+          this->first = leaf->next;
+        }
+        if (leaf->next != nullptr) {
+          leaf->next->prev = leaf->prev;
+        }
+        this->pool.free(leaf);
+      } else {
+        // Only emptied once its last child is gone, and it has no keys
+        this->pool.free((Inner*)node);
+      }
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Position of an entry, in key order
+     */
+    template <class VV>
+    class Iterator {
+    private:
+      friend class BTreeMap;
+      Leaf* leaf;
+      size_t i;
+
+      Iterator(Leaf* leaf, size_t i) : leaf(leaf), i(i) {
+        // Only an empty root leaf can be empty, which is the end
+        if (this->leaf != nullptr && this->i == this->leaf->n) {
+          this->leaf = this->leaf->next;
+          this->i = 0;
+        }
+      }
+
+    public:
+      const K& key() const { return this->leaf->keys()[this->i]; }
+      VV& value() const { return this->leaf->values()[this->i]; }
+      std::pair<const K&, VV&> operator*() const { return {this->key(), this->value()}; }
+
+      Iterator& operator++() {
+        if (++this->i == this->leaf->n) {
+          this->leaf = this->leaf->next;
+          this->i = 0;
+        }
+        return *this;
+      }
+
+      bool operator==(const Iterator& other) const { return this->leaf == other.leaf && this->i == other.i; }
+      bool operator!=(const Iterator& other) const { return !(*this == other); }
+    };
+
+    using iterator = Iterator<V>;
+    using const_iterator = Iterator<const V>;
+
+    /**
+     * @brief Construct an empty map allocating its nodes in given pool
+     *
+     * @param pool The pool to allocate nodes in
+     * @param less Ordering of keys
+     */
+    explicit BTreeMap(Pool& pool, const Compare& less = Compare()) : pool(pool), less(less) {
+      this->first = this->newLeaf();
+      this->root = this->first;
+    }
+
+    BTreeMap(const BTreeMap&) = delete;
+    BTreeMap& operator=(const BTreeMap&) = delete;
+
+    ~BTreeMap() {
+      this->destroy(this->root);
+    }
+
+    /**
+     * @brief Inserts a key and value unless the key is present
+     *
+     * @param key The key
+     * @param value The value
+     * @return true If the key was inserted
+     * @return false If the key was present, its value is unchanged
+     */
+    template <class KK, class VV>
+    bool insert(KK&& key, VV&& value) {
+      std::optional<K> sep;
+      bool inserted = false;
+      Node* right = this->insert(this->root, std::forward<KK>(key), std::forward<VV>(value), sep, inserted);
+      if (right != nullptr) {
+        Inner* root = this->newInner();
+        new (&root->keys()[0]) K(std::move(*sep));
+        root->children[0] = this->root;
+        root->children[1] = right;
+        root->n = 1;
+        this->root = root;
+      }
+      this->count += inserted;
+      return inserted;
+    }
+
+    /**
+     * @brief Returns a pointer to the value of a key, or nullptr
+     */
+    V* find(const K& key) {
+      Node* node = this->root;
+      while (!node->leaf) {
+        node = ((Inner*)node)->children[this->childIndex((Inner*)node, key)];
+      }
+      Leaf* leaf = (Leaf*)node;
+      const size_t i = this->lowerIndex(leaf->keys(), leaf->n, key);
+      return i < leaf->n && this->equal(leaf->keys()[i], key) ? &leaf->values()[i] : nullptr;
+    }
+
+    const V* find(const K& key) const {
+      return const_cast<BTreeMap*>(this)->find(key);
+    }
+
+    /**
+     * @brief Removes a key. Nodes left empty go back to the pool.
+     *
+     * @param key The key to remove
+     * @return true If the key was present
+     */
+    bool erase(const K& key) {
+      bool emptied = false;
+      if (!this->erase(this->root, key, emptied)) {
+        return false;
+      }
+      this->count--;
+      if (emptied && !this->root->leaf) {
+        this->pool.free((Inner*)this->root);
+        this->first = this->newLeaf();
+        this->root = this->first;
+      }
+      // Shorten the tree while the root has a single child
+      while (!this->root->leaf && this->root->n == 0) {
+        Inner* old = (Inner*)this->root;
+        this->root = old->children[0];
+        this->pool.free(old);
+      }
+      return true;
+    }
+
+    /**
+     * @brief Replaces the contents of the map with sorted entries, building
+     * the tree bottom-up with full leaves
+     *
+     * @tparam It Input iterator over pairs with first and second
+     * @param begin First entry
+     * @param end Past the last entry
+     * @pre Keys are strictly ascending
+     */
+    template <class It>
+    void bulkLoad(It begin, It end) {
+      this->destroy(this->root);
+      this->count = 0;
+      // Nodes of the level being built, with the lowest key below each
+      std::vector<std::pair<Node*, const K*>> level;
+      Leaf* leaf = nullptr;
+      for (It it = begin; it != end; ++it) {
+        if (leaf == nullptr || leaf->n == leafCapacity) {
+          Leaf* next = this->newLeaf();
+          next->prev = leaf;
+          if (leaf != nullptr) {
+            leaf->next = next;
+          }
+          leaf = next;
+        }
+        assert(leaf->n == 0 || this->less(leaf->keys()[leaf->n - 1], it->first));
+        new (&leaf->keys()[leaf->n]) K(it->first);
+        new (&leaf->values()[leaf->n]) V(it->second);
+        if (leaf->n++ == 0) {
+          level.emplace_back(leaf, &leaf->keys()[0]);
+        }
+        this->count++;
+      }
+      if (level.empty()) {
+        this->first = this->newLeaf();
+        this->root = this->first;
+        return;
+      }
+      this->first = (Leaf*)level.front().first;
+      while (level.size() > 1) {
+        std::vector<std::pair<Node*, const K*>> parents;
+        for (size_t i = 0; i < level.size();) {
+          Inner* inner = this->newInner();
+          const size_t n = std::min(level.size() - i, innerCapacity + 1);
+          inner->children[0] = level[i].first;
+          for (size_t j = 1; j < n; j++) {
+            new (&inner->keys()[j - 1]) K(*level[i + j].second);
+            inner->children[j] = level[i + j].first;
+          }
+          inner->n = (uint16_t)(n - 1);
+          parents.emplace_back(inner, level[i].second);
+          i += n;
+        }
+        level = std::move(parents);
+      }
+      this->root = level.front().first;
+    }
+
+    /**
+     * @brief Calls f(key, value) for every entry with lo <= key < hi, in key
+     * order, streaming along the leaves
+     *
+     * @param lo Lowest key to visit
+     * @param hi Key to stop before
+     * @param f Callable taking const K& and V&
+     */
+    template <class F>
+    void scan(const K& lo, const K& hi, F&& f) {
+      for (iterator it = this->lowerBound(lo), e = this->end(); it != e && this->less(it.key(), hi); ++it) {
+        f(it.key(), it.value());
+      }
+    }
+
+    /**
+     * @brief Returns an iterator to the first entry whose key is not less than
+     * key
+     */
+    iterator lowerBound(const K& key) {
+      Node* node = this->root;
+      while (!node->leaf) {
+        node = ((Inner*)node)->children[this->childIndex((Inner*)node, key)];
+      }
+      Leaf* leaf = (Leaf*)node;
+      return iterator(leaf, this->lowerIndex(leaf->keys(), leaf->n, key));
+    }
+
+    iterator begin() { return iterator(this->first, 0); }
+    iterator end() { return iterator(nullptr, 0); }
+    const_iterator begin() const { return const_iterator(this->first, 0); }
+    const_iterator end() const { return const_iterator(nullptr, 0); }
+
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+  };
+}  // namespace benpm
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#include "mempool.hpp"
+#include "pool_vector.hpp"
+
+#if !defined(__unix__) && !defined(__APPLE__)
+  #error "buffer_chain.hpp requires POSIX writev"
+#endif
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+  #define IOV_MAX 1024
+#endif
+
+namespace benpm {
+  /**
+   * @brief Chain of buffer fragments for scatter-gather writes, with
+   * fragments allocated in a memory pool
+   *
+   * A response is built by allocating fragments from the pool and writing
+   * into them in place, or by referencing memory that outlives the write,
+   * and is then handed to writev/sendmsg/pwritev as an iovec array, so the
+   * bytes are never gathered into one buffer. Consecutive allocations that
+   * the pool places back to back in the same chunk share one iovec.
+   *
+   * Fragments are released all at once by release, typically after the
+   * write completed, with a single pool call. The chain's own bookkeeping
+   * lives in the pool too and is kept across releases for reuse.
+   *
+   * @tparam Pool The memory pool type fragments are allocated in
+   */
+  template <class Pool = MemPool<>>
+  class BufferChain {
+  private:  // ------------------------------------------------------------
+    Pool& pool;
+    // Data to write, in order
+    PoolVector<iovec, Pool> fragments;
+    // Pool allocations to release, as pointer and size
+    PoolVector<std::pair<void*, size_t>, Pool> owned;
+    // Total bytes in the chain
+    size_t bytes = 0;
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct an empty chain allocating fragments in given pool
+     *
+     * @param pool The pool to allocate fragments in
+     */
+    explicit BufferChain(Pool& pool) : pool(pool), fragments(pool), owned(pool) {}
+
+    BufferChain(const BufferChain&) = delete;
+    BufferChain& operator=(const BufferChain&) = delete;
+
+    ~BufferChain() {
+      this->release();
+    }
+
+    /**
+     * @brief Appends a fragment of n bytes allocated in the pool and returns
+     * it to be filled in place
+     *
+     * @param n Size of the fragment in bytes, at most the pool's chunk size.
+     * If 0, nothing is allocated or appended
+     * @return char* The fragment
+     * @throws std::bad_alloc If n exceeds the pool's chunk size
+     */
+    char* allocate(size_t n) {
+      if (n == 0) {
+        // The pool reserves a byte even for an empty allocation, which a
+        // merge below would not count, so take nothing and add no fragment
+        static char empty;
+        return &empty;
+      }
+      char* data = (char*)this->pool.allocate(n, 1);
+      this->bytes += n;
+      if (!this->fragments.empty() && !this->owned.empty()) {
+        iovec& last = this->fragments.back();
+        std::pair<void*, size_t>& lastOwned = this->owned.back();
+        // Merge with the previous allocation if it ends right here in the
+        // same chunk, so a single release still charges the right chunk
+        if ((char*)last.iov_base + last.iov_len == data && lastOwned.first == last.iov_base &&
+            (uintptr_t)data % Pool::getChunkSize() != 0) {
+          last.iov_len += n;
+          lastOwned.second += n;
+          return data;
+        }
+      }
+      this->fragments.pushBack(iovec{data, n});
+      this->owned.pushBack({data, n});
+      return data;
+    }
+
+    /**
+     * @brief Appends a copy of n bytes, for small pieces such as headers
+     *
+     * @param data The bytes to copy
+     * @param n Number of bytes, at most the pool's chunk size
+     */
+    void appendCopy(const void* data, size_t n) {
+      std::memcpy(this->allocate(n), data, n);
+    }
+
+    /**
+     * @brief Appends a reference to memory that is not owned by the chain,
+     * without copying. The memory must stay valid until the write completes.
+     *
+     * @param data The bytes to reference
+     * @param n Number of bytes
+     */
+    void appendRef(const void* data, size_t n) {
+      this->fragments.pushBack(iovec{(void*)data, n});
+      this->bytes += n;
+    }
+
+    /**
+     * @brief Fills out with up to maxIov iovecs describing the chain from
+     * byte offset skip on, for writev/sendmsg/pwritev. Skipping lets a
+     * partial write be resumed.
+     *
+     * @param out Array to fill
+     * @param maxIov Capacity of out
+     * @param skip Number of leading bytes to leave out
+     * @return size_t Number of iovecs written to out
+     */
+    size_t exportIovecs(iovec* out, size_t maxIov, size_t skip = 0) const {
+      size_t n = 0;
+      for (size_t i = 0; i < this->fragments.size() && n < maxIov; i++) {
+        const iovec& f = this->fragments[i];
+        if (skip >= f.iov_len) {
+          skip -= f.iov_len;
+          continue;
+        }
+        out[n++] = iovec{(char*)f.iov_base + skip, f.iov_len - skip};
+        skip = 0;
+      }
+      return n;
+    }
+
+    /**
+     * @brief Writes the whole chain to a file descriptor with writev,
+     * resuming after partial writes and interrupts
+     *
+     * @param fd File descriptor to write to, in blocking mode
+     * @return size_t Number of bytes written, the size of the chain
+     * @throws std::system_error If writev fails
+     */
+    size_t writeTo(int fd) const {
+      iovec iov[IOV_MAX < 1024 ? IOV_MAX : 1024];
+      const size_t maxIov = sizeof(iov) / sizeof(iov[0]);
+      size_t written = 0;
+      while (written < this->bytes) {
+        const size_t n = this->exportIovecs(iov, maxIov, written);
+        const ssize_t r = ::writev(fd, iov, (int)n);
+        if (r < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw std::system_error(errno, std::generic_category(), "writev");
+        }
+        written += (size_t)r;
+      }
+      return written;
+    }
+
+    /**
+     * @brief Releases every fragment allocated by the chain back to the pool
+     * in one batch and empties the chain
+     */
+    void release() {
+      this->pool.deallocateBatch(this->owned.begin(), this->owned.end());
+      this->owned.clear();
+      this->fragments.clear();
+      this->bytes = 0;
+    }
+
+    /**
+     * @brief Returns the number of bytes in the chain
+     */
+    size_t size() const { return this->bytes; }
+
+    /**
+     * @brief Returns the number of iovecs the chain exports to
+     */
+    size_t getNumFragments() const { return this->fragments.size(); }
+  };
+}  // namespace benpm
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief Concurrent hash map whose nodes and bucket arrays live in memory
+   * pools
+   *
+   * Keys are spread over numStripes independent stripes by hash. Each stripe is
+   * a chained hash table with its own lock and its own pool, so threads working
+   * on different stripes never share a lock, an allocator or a cache line of
+   * allocation state. Bucket arrays are split into chunk sized segments taken
+   * from the stripe's pool; rehashing relinks the existing nodes into new
+   * segments and returns the old ones to the pool, so once the pools are warm
+   * inserts, erases and rehashes never reach the system allocator.
+   *
+   * Values are only accessed under their stripe's lock: find copies the value
+   * out, and update runs a callback on it in place.
+   *
+   * @tparam K Key type
+   * @tparam V Value type
+   * @tparam Hash Hash function for keys
+   * @tparam KeyEqual Equality for keys
+   * @tparam numStripes Number of independently locked stripes. Must be a power of 2!
+   * @tparam Pool Memory pool type used by each stripe
+   */
+  template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>,
+            size_t numStripes = 16, class Pool = MemPool<>>
+  class ConcurrentHashMap {
+  private:  // ------------------------------------------------------------
+    static_assert(numStripes > 0 && (numStripes & (numStripes - 1)) == 0, "numStripes must be a power of 2");
+
+    struct Node {
+      Node* next;
+      size_t hash;
+      K key;
+      V value;
+
+      template <class KK, class... VV>
+      Node(size_t hash, KK&& key, VV&&... value)
+          : next(nullptr), hash(hash), key(std::forward<KK>(key)), value(std::forward<VV>(value)...) {}
+    };
+
+    static_assert(sizeof(Node) <= Pool::getMaxAllocSize(alignof(Node)), "Node is too large for the pool's chunks");
+
+    // Buckets per chunk sized segment, and segments per stripe
+    static constexpr size_t segmentBuckets = detail::floorPow2(Pool::getMaxAllocSize(alignof(Node*)) / sizeof(Node*));
+    static constexpr size_t maxSegments = Pool::getMaxAllocSize(alignof(Node**)) / sizeof(Node**);
+    // Buckets a stripe starts out with
+    static constexpr size_t initialBuckets = segmentBuckets < 16 ? segmentBuckets : 16;
+
+    static_assert((segmentBuckets & (segmentBuckets - 1)) == 0, "Segments must hold a power of 2 buckets");
+
+    struct alignas(cacheLineSize) Stripe {
+      mutable std::mutex mutex;
+      Pool pool;
+      Node*** segments = nullptr;  // Directory of bucket segments, maxSegments long
+      size_t mask = 0;             // Number of buckets - 1
+      size_t size = 0;             // Number of nodes
+
+      Node*& bucket(size_t hash) const {
+        const size_t i = hash & this->mask;
+        return this->segments[i / segmentBuckets][i % segmentBuckets];
+      }
+    };
+
+    std::array<Stripe, numStripes> stripes;
+    Hash hasher;
+    KeyEqual equal;
+
+    // Returns the scrambled hash of a key. Stripes are picked by its high bits
+    // and buckets by its low bits, so they stay independent
+    size_t hashOf(const K& key) const {
+      const uint64_t h = (uint64_t)this->hasher(key) * 0x9E3779B97F4A7C15ull;
+      return (size_t)(h ^ (h >> 32));
+    }
+
+    Stripe& stripeOf(size_t hash) {
+      return this->stripes[(hash >> 32) & (numStripes - 1)];
+    }
+
+    const Stripe& stripeOf(size_t hash) const {
+      return this->stripes[(hash >> 32) & (numStripes - 1)];
+    }
+
+    // Allocates bucket segments for a table of given size, all buckets empty.
+    // If an allocation throws, the segments allocated so far are returned
+    static void allocSegments(Stripe& s, Node*** segments, size_t buckets) {
+      const size_t perSegment = buckets < segmentBuckets ? buckets : segmentBuckets;
+      const size_t numSegments = (buckets + segmentBuckets - 1) / segmentBuckets;
+      for (size_t i = 0; i < numSegments; i++) {
+        try {
+          segments[i] = (Node**)s.pool.allocate(perSegment * sizeof(Node*), alignof(Node*));
+        } catch (...) {
+          for (size_t j = 0; j < i; j++) {
+            s.pool.deallocate(segments[j], perSegment * sizeof(Node*));
+          }
+          throw;
+        }
+        for (size_t j = 0; j < perSegment; j++) {
+          segments[i][j] = nullptr;
+        }
+      }
+    }
+
+    // Returns the bucket segments of a table of given size to the pool
+    static void freeSegments(Stripe& s, Node*** segments, size_t buckets) {
+      const size_t perSegment = buckets < segmentBuckets ? buckets : segmentBuckets;
+      for (size_t i = 0; i < (buckets + segmentBuckets - 1) / segmentBuckets; i++) {
+        s.pool.deallocate(segments[i], perSegment * sizeof(Node*));
+      }
+    }
+
+    // Doubles the number of buckets of a stripe, relinking its nodes. Does
+    // nothing once the directory is full. The new segments are all allocated
+    // before the stripe changes, so if that throws the stripe is left as it
+    // was. Must be called with the lock held
+    static void grow(Stripe& s) {
+      const size_t oldBuckets = s.mask + 1;
+      const size_t newBuckets = oldBuckets * 2;
+      const size_t newSegments = (newBuckets + segmentBuckets - 1) / segmentBuckets;
+      if (newSegments > maxSegments) {
+        return;
+      }
+      // The new directory entries are gathered in a scratch array from the
+      // pool, then copied over the old ones once the nodes are relinked
+      Node*** fresh = (Node***)s.pool.allocate(newSegments * sizeof(Node**), alignof(Node**));
+      try {
+        allocSegments(s, fresh, newBuckets);
+      } catch (...) {
+        s.pool.deallocate(fresh, newSegments * sizeof(Node**));
+        throw;
+      }
+      const size_t newMask = newBuckets - 1;
+      const size_t oldSegments = (oldBuckets + segmentBuckets - 1) / segmentBuckets;
+      const size_t perSegment = oldBuckets < segmentBuckets ? oldBuckets : segmentBuckets;
+      for (size_t i = 0; i < oldSegments; i++) {
+        for (size_t j = 0; j < perSegment; j++) {
+          for (Node* node = s.segments[i][j]; node != nullptr;) {
+            Node* next = node->next;
+            const size_t b = node->hash & newMask;
+            Node*& head = fresh[b / segmentBuckets][b % segmentBuckets];
+            node->next = head;
+            head = node;
+            node = next;
+          }
+        }
+      }
+      freeSegments(s, s.segments, oldBuckets);
+      for (size_t i = 0; i < newSegments; i++) {
+        s.segments[i] = fresh[i];
+      }
+      s.mask = newMask;
+      s.pool.deallocate(fresh, newSegments * sizeof(Node**));
+    }
+
+    // Returns the node for key in a stripe, or nullptr. Must be called with
+    // the lock held
+    Node* findNode(const Stripe& s, const K& key, size_t hash) const {
+      for (Node* node = s.bucket(hash); node != nullptr; node = node->next) {
+        if (node->hash == hash && this->equal(node->key, key)) {
+          return node;
+        }
+      }
+      return nullptr;
+    }
+
+    // Links a new node into a stripe, growing it past a load factor of 1.
+    // Must be called with the lock held
+    template <class KK, class... VV>
+    void insertNode(Stripe& s, size_t hash, KK&& key, VV&&... value) {
+      Node* node = s.pool.template make<Node>(hash, std::forward<KK>(key), std::forward<VV>(value)...);
+      Node*& head = s.bucket(hash);
+      node->next = head;
+      head = node;
+      if (++s.size > s.mask + 1) {
+        try {
+          grow(s);
+        } catch (const std::bad_alloc&) {
+          // The node is in, and a stripe that cannot grow keeps working with
+          // longer chains
+        }
+      }
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct an empty map
+     *
+     * @param hasher Hash function for keys
+     * @param equal Equality for keys
+     */
+    explicit ConcurrentHashMap(const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual())
+        : hasher(hasher), equal(equal) {
+      for (Stripe& s : this->stripes) {
+        s.segments = (Node***)s.pool.allocate(maxSegments * sizeof(Node**), alignof(Node**));
+        allocSegments(s, s.segments, initialBuckets);
+        s.mask = initialBuckets - 1;
+      }
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    ~ConcurrentHashMap() {
+      // Memory goes away with the pools, but keys and values need destructing
+      for (Stripe& s : this->stripes) {
+        for (size_t b = 0; b <= s.mask; b++) {
+          for (Node* node = s.bucket(b); node != nullptr;) {
+            Node* next = node->next;
+            node->~Node();
+            node = next;
+          }
+        }
+      }
+    }
+
+    /**
+     * @brief Inserts a key and value if the key is not in the map yet
+     *
+     * @note This function is thread-safe.
+     *
+     * @param key The key
+     * @param value The value
+     * @return true If the key was inserted
+     * @return false If the key was already present, its value is unchanged
+     */
+    template <class KK, class VV>
+    bool insert(KK&& key, VV&& value) {
+      const size_t hash = this->hashOf(key);
+      Stripe& s = this->stripeOf(hash);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (this->findNode(s, key, hash) != nullptr) {
+        return false;
+      }
+      this->insertNode(s, hash, std::forward<KK>(key), std::forward<VV>(value));
+      return true;
+    }
+
+    /**
+     * @brief Inserts a key and value, or replaces the value if the key is
+     * already in the map
+     *
+     * @note This function is thread-safe.
+     *
+     * @param key The key
+     * @param value The value
+     * @return true If the key was inserted
+     * @return false If the value of an existing key was replaced
+     */
+    template <class KK, class VV>
+    bool assign(KK&& key, VV&& value) {
+      const size_t hash = this->hashOf(key);
+      Stripe& s = this->stripeOf(hash);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (Node* node = this->findNode(s, key, hash)) {
+        node->value = std::forward<VV>(value);
+        return false;
+      }
+      this->insertNode(s, hash, std::forward<KK>(key), std::forward<VV>(value));
+      return true;
+    }
+
+    /**
+     * @brief Copies the value of a key
+     *
+     * @note This function is thread-safe.
+     *
+     * @param key The key to look up
+     * @param value Receives a copy of the value if the key is present
+     * @return true If the key is present
+     */
+    bool find(const K& key, V& value) const {
+      const size_t hash = this->hashOf(key);
+      const Stripe& s = this->stripeOf(hash);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (Node* node = this->findNode(s, key, hash)) {
+        value = node->value;
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * @brief Returns true if the key is in the map
+     *
+     * @note This function is thread-safe.
+     */
+    bool contains(const K& key) const {
+      const size_t hash = this->hashOf(key);
+      const Stripe& s = this->stripeOf(hash);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      return this->findNode(s, key, hash) != nullptr;
+    }
+
+    /**
+     * @brief Calls f with a reference to the value of a key, under the lock of
+     * its stripe. f must not access the map.
+     *
+     * @note This function is thread-safe.
+     *
+     * @param key The key to look up
+     * @param f Callable taking V&
+     * @return true If the key is present and f was called
+     */
+    template <class F>
+    bool update(const K& key, F&& f) {
+      const size_t hash = this->hashOf(key);
+      Stripe& s = this->stripeOf(hash);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (Node* node = this->findNode(s, key, hash)) {
+        f(node->value);
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * @brief Removes a key, returning its node to the stripe's pool
+     *
+     * @note This function is thread-safe.
+     *
+     * @param key The key to remove
+     * @return true If the key was present
+     */
+    bool erase(const K& key) {
+      const size_t hash = this->hashOf(key);
+      Stripe& s = this->stripeOf(hash);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      for (Node** link = &s.bucket(hash); *link != nullptr; link = &(*link)->next) {
+        Node* node = *link;
+        if (node->hash == hash && this->equal(node->key, key)) {
+          *link = node->next;
+          s.size--;
+          s.pool.free(node);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * @brief Calls f(key, value) for every entry, one stripe at a time under
+     * its lock. f must not access the map.
+     *
+     * @note This function is thread-safe, but entries changed in stripes
+     * already visited are not seen.
+     *
+     * @param f Callable taking const K& and V&
+     */
+    template <class F>
+    void forEach(F&& f) {
+      for (Stripe& s : this->stripes) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (size_t b = 0; b <= s.mask; b++) {
+          for (Node* node = s.bucket(b); node != nullptr; node = node->next) {
+            f((const K&)node->key, node->value);
+          }
+        }
+      }
+    }
+
+    /**
+     * @brief Returns the number of entries
+     *
+     * @note This function is thread-safe, the result may be stale.
+     *
+     * @return size_t
+     */
+    size_t size() const {
+      size_t n = 0;
+      for (const Stripe& s : this->stripes) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        n += s.size;
+      }
+      return n;
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief A string interned in a StringInterner
+   */
+  struct InternedString {
+    uint32_t id;           // Dense id, starting at 0 in order of interning
+    std::string_view str;  // Interned copy, stable for the pool's lifetime
+  };
+
+  /**
+   * @brief Deduplicating string table stored in a memory pool
+   *
+   * Every distinct string is copied once into the pool, right behind its hash
+   * table entry, and gets a stable string_view and a small dense id. The hash
+   * table's slot arrays live in the pool too. Lookups of strings that are
+   * already interned take no lock: slots are only ever filled, never cleared,
+   * and a grown table is fully built before it is published. Misses insert
+   * under a mutex.
+   *
+   * Nothing is freed individually: interned data is released in bulk when the
+   * pool is destroyed, so the pool must outlive every string_view handed out.
+   * If the pool is shared with other threads, define MEMPOOL_THREADSAFE.
+   *
+   * @tparam Pool The memory pool type
+   */
+  template <class Pool = MemPool<>>
+  class StringInterner {
+  private:  // ------------------------------------------------------------
+    // Hash table entry, followed by the string and a terminating NUL
+    struct Entry {
+      size_t hash;
+      uint32_t id;
+      uint32_t len;
+
+      Entry(size_t hash, uint32_t id, uint32_t len) : hash(hash), id(id), len(len) {}
+      std::string_view view() const { return std::string_view((const char*)trailing(this), this->len); }
+    };
+
+    using Slot = std::atomic<const Entry*>;
+
+    // Slots per pool allocated slot array, and entry pointers per id segment
+    static constexpr size_t segmentSlots = detail::floorPow2(Pool::getMaxAllocSize(alignof(Slot)) / sizeof(Slot));
+    static constexpr size_t idSegmentSize = Pool::getMaxAllocSize(alignof(const Entry*)) / sizeof(const Entry*);
+    // Maximum number of id segments, bounding the number of strings
+    static constexpr size_t maxIdSegments = (size_t)1 << 14;
+
+    static_assert((segmentSlots & (segmentSlots - 1)) == 0, "Slot arrays must hold a power of 2 slots");
+
+    // Open addressing hash table split into chunk sized slot arrays
+    struct Table {
+      size_t mask;                        // Number of slots - 1
+      std::unique_ptr<Slot*[]> segments;  // Slot arrays, each segmentSlots long
+
+      Slot& slot(size_t i) const { return this->segments[i / segmentSlots][i % segmentSlots]; }
+    };
+
+    Pool& pool;
+    // Current table, replaced when it gets half full
+    std::atomic<Table*> table;
+    // All tables ever built. Old ones may still be read by lookups
+    std::vector<std::unique_ptr<Table>> tables;
+    // Id to entry directory, pointing to segments of idSegmentSize entries
+    struct IdDirectory {
+      size_t capacity;  // Number of segments it can point to
+      std::unique_ptr<std::atomic<const Entry**>[]> segments;
+    };
+    // Current id directory, replaced by one twice the size when full
+    std::atomic<IdDirectory*> ids;
+    // All id directories ever built. Old ones may still be read by lookups
+    std::vector<std::unique_ptr<IdDirectory>> idDirectories;
+    // Number of interned strings
+    std::atomic<uint32_t> count;
+    // Serializes inserts
+    std::mutex mutex;
+
+    // Returns the entry for s in table t, or nullptr
+    static const Entry* find(const Table* t, std::string_view s, size_t hash) {
+      for (size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+        const Entry* e = t->slot(i).load(std::memory_order_acquire);
+        if (e == nullptr) {
+          return nullptr;
+        }
+        if (e->hash == hash && e->view() == s) {
+          return e;
+        }
+      }
+    }
+
+    // Puts e in the first free slot of its probe sequence in table t
+    static void place(const Table* t, const Entry* e) {
+      size_t i = e->hash & t->mask;
+      while (t->slot(i).load(std::memory_order_relaxed) != nullptr) {
+        i = (i + 1) & t->mask;
+      }
+      t->slot(i).store(e, std::memory_order_release);
+    }
+
+    // Builds a table with given number of slots holding every entry so far.
+    // Must be called with the mutex held
+    Table* build(size_t slots) {
+      auto t = std::make_unique<Table>();
+      t->mask = slots - 1;
+      const size_t numSegments = (slots + segmentSlots - 1) / segmentSlots;
+      const size_t perSegment = slots < segmentSlots ? slots : segmentSlots;
+      t->segments = std::make_unique<Slot*[]>(numSegments);
+      for (size_t s = 0; s < numSegments; s++) {
+        Slot* seg = (Slot*)this->pool.allocate(perSegment * sizeof(Slot), alignof(Slot));
+        for (size_t i = 0; i < perSegment; i++) {
+          new (&seg[i]) Slot(nullptr);
+        }
+        t->segments[s] = seg;
+      }
+      const uint32_t n = this->count.load(std::memory_order_relaxed);
+      for (uint32_t id = 0; id < n; id++) {
+        place(t.get(), this->entry(id));
+      }
+      this->tables.push_back(std::move(t));
+      return this->tables.back().get();
+    }
+
+    // Builds an id directory with given capacity pointing to the segments
+    // so far. Must be called with the mutex held
+    IdDirectory* buildIds(size_t capacity) {
+      auto dir = std::make_unique<IdDirectory>();
+      dir->capacity = capacity;
+      dir->segments = std::make_unique<std::atomic<const Entry**>[]>(capacity);
+      if (const IdDirectory* old = this->ids.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < old->capacity; i++) {
+          dir->segments[i].store(old->segments[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+      }
+      this->idDirectories.push_back(std::move(dir));
+      return this->idDirectories.back().get();
+    }
+
+    // Returns the entry with given id
+    const Entry* entry(uint32_t id) const {
+      const IdDirectory* dir = this->ids.load(std::memory_order_acquire);
+      const Entry** seg = dir->segments[id / idSegmentSize].load(std::memory_order_acquire);
+      return seg[id % idSegmentSize];
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct a new string interner storing its data in given pool
+     *
+     * @param pool The pool to store strings and table slots in
+     */
+    explicit StringInterner(Pool& pool) : pool(pool), ids(nullptr), count(0) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->ids.store(this->buildIds(4), std::memory_order_release);
+      this->table.store(this->build(64), std::memory_order_release);
+    }
+
+    /**
+     * @brief Interns a string, returns its id and stable copy
+     *
+     * @note This function is thread-safe, and lock-free for strings that are
+     * already interned.
+     *
+     * @param s The string to intern
+     * @return InternedString
+     * @throws std::bad_alloc If the string does not fit in a chunk
+     */
+    InternedString intern(std::string_view s) {
+      const size_t hash = std::hash<std::string_view>()(s);
+      if (const Entry* e = find(this->table.load(std::memory_order_acquire), s, hash)) {
+        return {e->id, e->view()};
+      }
+      std::lock_guard<std::mutex> lock(this->mutex);
+      Table* t = this->table.load(std::memory_order_relaxed);
+      if (const Entry* e = find(t, s, hash)) {
+        return {e->id, e->view()};
+      }
+      const uint32_t id = this->count.load(std::memory_order_relaxed);
+      if (id / idSegmentSize >= maxIdSegments) {
+        throw std::bad_alloc();
+      }
+      Entry* e = this->pool.template makeWithTrailing<Entry>(s.size() + 1, hash, id, (uint32_t)s.size());
+      std::memcpy(trailing(e), s.data(), s.size());
+      ((char*)trailing(e))[s.size()] = '\0';
+      IdDirectory* dir = this->ids.load(std::memory_order_relaxed);
+      if (id % idSegmentSize == 0) {
+        if (id / idSegmentSize >= dir->capacity) {
+          // Full: publish a directory of twice the size
+          dir = this->buildIds(std::min(dir->capacity * 2, maxIdSegments));
+          this->ids.store(dir, std::memory_order_release);
+        }
+        const Entry** seg = (const Entry**)this->pool.allocate(idSegmentSize * sizeof(const Entry*), alignof(const Entry*));
+        dir->segments[id / idSegmentSize].store(seg, std::memory_order_release);
+      }
+      dir->segments[id / idSegmentSize].load(std::memory_order_relaxed)[id % idSegmentSize] = e;
+      this->count.store(id + 1, std::memory_order_release);
+      if ((size_t)(id + 1) * 2 > t->mask + 1) {
+        // Half full: publish a table of twice the size, which includes e
+        this->table.store(this->build((t->mask + 1) * 2), std::memory_order_release);
+      } else {
+        place(t, e);
+      }
+      return {id, e->view()};
+    }
+
+    /**
+     * @brief Returns the interned string with given id
+     *
+     * @note This function is thread-safe and lock-free.
+     *
+     * @param id An id returned by intern
+     * @return std::string_view
+     */
+    std::string_view str(uint32_t id) const {
+      return this->entry(id)->view();
+    }
+
+    /**
+     * @brief Returns the number of interned strings
+     *
+     * @return size_t
+     */
+    size_t size() const {
+      return this->count.load(std::memory_order_acquire);
+    }
+  };
+}  // namespace benpm
@@ -1,18 +1,652 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
+#include <algorithm>
 #include <unordered_map>
 #include <functional>
+#include <iterator>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
 
 // #define MEMPOOL_THREADSAFE
-// #define MEMPOOL_EMPTY_INSERT_AFTER
+// #define MEMPOOL_CACHE_LINE_SIZE 128
+// #define MEMPOOL_TYPE_TAGS
+// #define MEMPOOL_MAX_TYPE_TAGS 65534
+// #define MEMPOOL_GC
+// #define MEMPOOL_ALLOC_SITES
+// #define MEMPOOL_MAX_ALLOC_SITES 65535
+
+#ifndef MEMPOOL_CACHE_LINE_SIZE
+  #define MEMPOOL_CACHE_LINE_SIZE 64
+#endif
+
+// The collector finds objects and their types through the type tags
+#if defined(MEMPOOL_GC) && !defined(MEMPOOL_TYPE_TAGS)
+  #define MEMPOOL_TYPE_TAGS
+#endif
+
+// Allocation sites are recorded in the type tag headers
+#if defined(MEMPOOL_ALLOC_SITES) && !defined(MEMPOOL_TYPE_TAGS)
+  #define MEMPOOL_TYPE_TAGS
+#endif
+
+#ifndef MEMPOOL_MAX_TYPE_TAGS
+  #define MEMPOOL_MAX_TYPE_TAGS 4096
+#endif
+
+#ifndef MEMPOOL_MAX_ALLOC_SITES
+  #define MEMPOOL_MAX_ALLOC_SITES 4096
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+  #include <sys/mman.h>
+  #include <unistd.h>
+  #define MEMPOOL_MMAP
+#endif
+
+#if defined(__linux__)
+  #include <fcntl.h>
+  #define MEMPOOL_MEMFD
+#endif
+
+#if defined(__SSE2__)
+  #include <immintrin.h>
+#endif
 
 namespace benpm {
+  /**
+   * @brief Strategy a pool uses to pick the next chunk once the current one is
+   * full
+   */
+  enum class ChunkPolicy {
+    // Reuse the most recently emptied chunk, which is likely still in cache
+    Lifo,
+    // Reuse the empty chunk with the lowest address, so allocations pack into
+    // the first blocks and the working set shrinks
+    LowestAddress,
+    // Reuse the partially occupied chunk whose remaining space fits the
+    // request most tightly, falling back to an empty chunk
+    BestFit
+  };
+
+  /**
+   * @brief Running counters of a pool's chunk turnover
+   */
+  struct PoolStats {
+    size_t chunksTaken = 0;     // Times a chunk became the current chunk
+    size_t chunksRecycled = 0;  // Times a chunk emptied and became reusable
+  };
+
+  // Minimum distance between objects written by different threads. Fixed
+  // rather than std::hardware_destructive_interference_size, which can vary
+  // with compiler flags and would change the layout of MemPool
+  inline constexpr size_t cacheLineSize = MEMPOOL_CACHE_LINE_SIZE;
+
+  namespace detail {
+    // Returns a zeroed, size aligned block of size bytes, size a power of 2
+    inline void* mapBlock(size_t size) {
+      #ifdef MEMPOOL_MMAP
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        if (size % pageSize == 0) {
+          // Map twice the size and trim both ends to get an aligned block.
+          // Fresh anonymous pages are zero and only backed once touched
+          char* raw = (char*)mmap(nullptr, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+          if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+          }
+          char* block = (char*)(((uintptr_t)raw + size - 1) & ~(uintptr_t)(size - 1));
+          if (block > raw) {
+            munmap(raw, block - raw);
+          }
+          if (block + size < raw + 2 * size) {
+            munmap(block + size, raw + 2 * size - (block + size));
+          }
+          return block;
+        }
+      #endif
+      void* block = aligned_alloc(size, size);
+      if (block == nullptr) {
+        throw std::bad_alloc();
+      }
+      std::memset(block, 0, size);
+      return block;
+    }
+
+    // Releases a block returned by mapBlock
+    inline void unmapBlock(void* block, size_t size) {
+      #ifdef MEMPOOL_MMAP
+        if (size % (size_t)sysconf(_SC_PAGESIZE) == 0) {
+          munmap(block, size);
+          return;
+        }
+      #endif
+      std::free(block);
+    }
+
+    // Hints that size bytes at ptr, part of a block, are about to be
+    // written, so their pages are faulted in by one call instead of one
+    // fault per page
+    inline void prefault(void* ptr, size_t size) {
+      #if defined(MEMPOOL_MMAP) && defined(MADV_POPULATE_WRITE)
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        const uintptr_t first = (uintptr_t)ptr & ~(uintptr_t)(pageSize - 1);
+        // Older kernels reject the advice, which is harmless
+        madvise((void*)first, (uintptr_t)ptr + size - first, MADV_POPULATE_WRITE);
+      #else
+        (void)ptr;
+        (void)size;
+      #endif
+    }
+
+    // Returns a size aligned block of size bytes holding the file's contents
+    // at offset. Where possible the file is mapped copy-on-write, so pages
+    // are only read when touched
+    inline void* mapFileBlock(std::FILE* file, uint64_t offset, size_t size) {
+      void* block = mapBlock(size);
+      #ifdef MEMPOOL_MMAP
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        if (size % pageSize == 0 && offset % pageSize == 0) {
+          if (mmap(block, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), (off_t)offset) != MAP_FAILED) {
+            return block;
+          }
+        }
+      #endif
+      if (std::fseek(file, (long)offset, SEEK_SET) != 0 || std::fread(block, 1, size, file) != size) {
+        unmapBlock(block, size);
+        throw std::runtime_error("Pool snapshot is truncated");
+      }
+      return block;
+    }
+
+    #ifdef MEMPOOL_MEMFD
+      // Memory file holding the blocks of a pool that takes snapshots,
+      // shared by the pool and the snapshots reading it. The file is split
+      // in block sized regions, each counting its readers: the pool while a
+      // block is mapped over it, and the snapshots taken since. A region
+      // nobody reads is emptied and reused
+      struct BackingFile {
+        const int fd;
+        const size_t regionSize;
+        std::mutex mutex;
+        std::vector<uint32_t> readers;
+        std::vector<uint64_t> unused;
+
+        explicit BackingFile(size_t regionSize)
+            : fd(memfd_create("benpm", MFD_CLOEXEC)), regionSize(regionSize) {
+          if (this->fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "memfd_create");
+          }
+        }
+
+        BackingFile(const BackingFile&) = delete;
+        BackingFile& operator=(const BackingFile&) = delete;
+
+        ~BackingFile() {
+          close(this->fd);
+        }
+
+        // Returns the offset of a region with one reader, reusing an unused
+        // one or growing the file
+        uint64_t acquire() {
+          std::lock_guard<std::mutex> lock(this->mutex);
+          uint64_t offset;
+          if (!this->unused.empty()) {
+            offset = this->unused.back();
+            this->unused.pop_back();
+          } else {
+            offset = (uint64_t)this->readers.size() * this->regionSize;
+            if (ftruncate(this->fd, (off_t)(offset + this->regionSize)) != 0) {
+              throw std::system_error(errno, std::generic_category(), "ftruncate");
+            }
+            this->readers.push_back(0);
+          }
+          this->readers[offset / this->regionSize] = 1;
+          return offset;
+        }
+
+        void retain(uint64_t offset) {
+          std::lock_guard<std::mutex> lock(this->mutex);
+          this->readers[offset / this->regionSize]++;
+        }
+
+        // Drops a reader of a region, freeing its pages once it has none
+        void release(uint64_t offset) {
+          std::lock_guard<std::mutex> lock(this->mutex);
+          if (--this->readers[offset / this->regionSize] == 0) {
+            fallocate(this->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)this->regionSize);
+            this->unused.push_back(offset);
+          }
+        }
+
+        // Whether anyone besides the pool reads a region
+        bool shared(uint64_t offset) {
+          std::lock_guard<std::mutex> lock(this->mutex);
+          return this->readers[offset / this->regionSize] > 1;
+        }
+
+        uint64_t size() {
+          std::lock_guard<std::mutex> lock(this->mutex);
+          return (uint64_t)this->readers.size() * this->regionSize;
+        }
+
+        void write(const void* data, size_t size, uint64_t offset) {
+          while (size > 0) {
+            const ssize_t n = pwrite(this->fd, data, size, (off_t)offset);
+            if (n < 0) {
+              if (errno == EINTR) {
+                continue;
+              }
+              throw std::system_error(errno, std::generic_category(), "pwrite");
+            }
+            data = (const char*)data + n;
+            size -= (size_t)n;
+            offset += (uint64_t)n;
+          }
+        }
+
+        // Maps size bytes of the file at offset over addr, shared, or
+        // copy-on-write so that writes through addr stay out of the file
+        void map(void* addr, size_t size, uint64_t offset, bool copyOnWrite) {
+          const int flags = (copyOnWrite ? MAP_PRIVATE : MAP_SHARED) | MAP_FIXED;
+          if (mmap(addr, size, PROT_READ | PROT_WRITE, flags, this->fd, (off_t)offset) == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "mmap");
+          }
+        }
+      };
+
+      // Calls f(offset, size) for each run of pages in [addr, addr + size)
+      // that a copy-on-write file mapping has copied, i.e. that were written
+      // since it was mapped, as reported by /proc/self/pagemap. Returns false
+      // if pagemap cannot be read
+      template <class F>
+      bool forEachCopiedPage(int pagemap, void* addr, size_t size, F&& f) {
+        constexpr uint64_t present = (uint64_t)1 << 63;
+        constexpr uint64_t swapped = (uint64_t)1 << 62;
+        constexpr uint64_t filePage = (uint64_t)1 << 61;
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t numPages = size / pageSize;
+        std::vector<uint64_t> entries(numPages);
+        const off_t at = (off_t)((uintptr_t)addr / pageSize * sizeof(uint64_t));
+        if (pread(pagemap, entries.data(), numPages * sizeof(uint64_t), at) != (ssize_t)(numPages * sizeof(uint64_t))) {
+          return false;
+        }
+        size_t run = 0;
+        for (size_t i = 0; i <= numPages; i++) {
+          // Private copies are anonymous pages, in memory or swapped out
+          const bool copied = i < numPages && ((entries[i] & swapped) ||
+                                               ((entries[i] & present) && !(entries[i] & filePage)));
+          if (copied) {
+            run++;
+          } else if (run > 0) {
+            f((i - run) * pageSize, run * pageSize);
+            run = 0;
+          }
+        }
+        return true;
+      }
+    #endif
+
+    // Returns the largest power of 2 not above n, for n > 0
+    constexpr size_t floorPow2(size_t n) {
+      size_t p = 1;
+      while (p <= n / 2) {
+        p *= 2;
+      }
+      return p;
+    }
+
+    // Zeroes memory. Large ranges are cleared with non-temporal stores, which
+    // bypass the cache instead of evicting the working set
+    inline void clearMemory(void* ptr, size_t size) {
+      constexpr size_t streamThreshold = 1024;
+      #if defined(__AVX512F__)
+        constexpr size_t width = 64;
+      #elif defined(__AVX__)
+        constexpr size_t width = 32;
+      #elif defined(__SSE2__)
+        constexpr size_t width = 16;
+      #else
+        constexpr size_t width = 0;
+      #endif
+      if (width == 0 || size < streamThreshold) {
+        std::memset(ptr, 0, size);
+        return;
+      }
+      char* p = (char*)ptr;
+      char* end = p + size;
+      char* first = (char*)(((uintptr_t)p + width - 1) & ~(uintptr_t)(width - 1));
+      char* last = (char*)((uintptr_t)end & ~(uintptr_t)(width - 1));
+      std::memset(p, 0, first - p);
+      #if defined(__AVX512F__)
+        const __m512i zero = _mm512_setzero_si512();
+        for (char* q = first; q < last; q += width) {
+          _mm512_stream_si512((__m512i*)q, zero);
+        }
+      #elif defined(__AVX__)
+        const __m256i zero = _mm256_setzero_si256();
+        for (char* q = first; q < last; q += width) {
+          _mm256_stream_si256((__m256i*)q, zero);
+        }
+      #elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        for (char* q = first; q < last; q += width) {
+          _mm_stream_si128((__m128i*)q, zero);
+        }
+      #endif
+      #if defined(__SSE2__)
+        // Order the streaming stores before anything that publishes the memory
+        _mm_sfence();
+      #endif
+      std::memset(last, 0, end - last);
+    }
+  }  // namespace detail
+
+  /**
+   * @brief Specialize as std::true_type to give every pool allocated object of
+   * type T cache lines of its own, so objects written by different threads
+   * never share a line
+   */
+  template <class T>
+  struct CacheIsolated : std::false_type {};
+
+  /**
+   * @brief Returns the bytes a pool reserves for an object of type T
+   */
+  template <class T>
+  constexpr size_t allocSize() {
+    return CacheIsolated<T>::value ? (sizeof(T) + cacheLineSize - 1) & ~(cacheLineSize - 1) : sizeof(T);
+  }
+
+  /**
+   * @brief Returns the trailing storage of an object allocated with
+   * MemPool::makeWithTrailing, which directly follows the object
+   */
+  template <class T>
+  void* trailing(T* obj) {
+    return (char*)obj + sizeof(T);
+  }
+
+  /**
+   * @brief Returns the alignment a pool places an object of type T at
+   */
+  template <class T>
+  constexpr size_t allocAlign() {
+    return CacheIsolated<T>::value && cacheLineSize > alignof(T) ? cacheLineSize : alignof(T);
+  }
+
+  /**
+   * @brief Specialize to list the pointer members of T that point into a pool,
+   * so MemPool::save can relocate them and the collector of MEMPOOL_GC can
+   * trace them. forEach must call
+   * relocations.add(field) for every such member of obj:
+   * 
+   *     template <> struct PoolPointers<Node> {
+   *       static void forEach(Node& obj, Relocations& relocations) {
+   *         relocations.add(obj.next);
+   *       }
+   *     };
+   */
+  template <class T>
+  struct PoolPointers;
+
+  /**
+   * @brief Set of pointer fields to relocate when a pool snapshot is loaded
+   * at different addresses. Built by the caller of MemPool::save, by visiting
+   * the live objects.
+   */
+  class Relocations {
+  private:  // ------------------------------------------------------------
+    template <size_t, size_t> friend class MemPool;
+    std::vector<uintptr_t> fields;
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Adds a pointer field. Its value must be null or point into the
+     * pool being saved; anything else is left unchanged on load.
+     * 
+     * @param field The pointer field, which must itself lie in the pool
+     */
+    template <class T>
+    void add(T*& field) {
+      this->fields.push_back((uintptr_t)&field);
+    }
+
+    /**
+     * @brief Adds every pointer field of an object, as listed by
+     * PoolPointers<T>
+     * 
+     * @param obj Object allocated in the pool
+     */
+    template <class T>
+    void addObject(T* obj) {
+      PoolPointers<T>::forEach(*obj, *this);
+    }
+  };
+
+  /**
+   * @brief Type of pool allocated objects, registered the first time a type
+   * is allocated with MEMPOOL_TYPE_TAGS defined. Every allocation carries
+   * the tag of its type, which MemPool::visit maps back to this.
+   */
+  struct TypeInfo {
+    uint16_t tag;             // Index in the type registry
+    const char* name;         // Implementation defined name, from std::type_info
+    size_t size;              // sizeof the type
+    void (*destroy)(void*);   // Runs the destructor
+    void (*trace)(void*, Relocations&);  // Lists pointer fields through PoolPointers, or nullptr
+  };
+
+  // Tag of memory allocated without a type, e.g. with MemPool::allocate
+  inline constexpr uint16_t untypedTag = 0;
+
+  namespace detail {
+    static_assert(MEMPOOL_MAX_TYPE_TAGS <= 0xFFFE, "Type tags must leave room for the reserved ones");
+
+    // Registered types by tag, filled in as types are first used
+    inline std::atomic<const TypeInfo*> typeRegistry[MEMPOOL_MAX_TYPE_TAGS] = {};
+    inline std::atomic<size_t> numTypeTags{untypedTag + 1};
+
+    inline uint16_t nextTypeTag() {
+      const size_t tag = numTypeTags.fetch_add(1, std::memory_order_relaxed);
+      if (tag >= MEMPOOL_MAX_TYPE_TAGS) {
+        throw std::length_error("Too many pool allocated types, raise MEMPOOL_MAX_TYPE_TAGS");
+      }
+      return (uint16_t)tag;
+    }
+
+    template <class T>
+    void destroy(void* obj) {
+      ((T*)obj)->~T();
+    }
+
+    template <class T, class = void>
+    struct HasPoolPointers : std::false_type {};
+
+    template <class T>
+    struct HasPoolPointers<T, std::void_t<decltype(PoolPointers<T>::forEach(std::declval<T&>(), std::declval<Relocations&>()))>>
+        : std::true_type {};
+
+    template <class T>
+    void trace(void* obj, Relocations& relocations) {
+      PoolPointers<T>::forEach(*(T*)obj, relocations);
+    }
+
+    // Trace function of T, nullptr if T has no pool pointers
+    template <class T>
+    constexpr void (*traceOf())(void*, Relocations&) {
+      if constexpr (HasPoolPointers<T>::value) {
+        return &trace<T>;
+      } else {
+        return nullptr;
+      }
+    }
+  }  // namespace detail
+
+  /**
+   * @brief Returns the registry entry of type T, registering it on first use.
+   * A PoolPointers<T> specialization must be visible by then to be used for
+   * tracing.
+   */
+  template <class T>
+  const TypeInfo& typeInfoOf() {
+    static const TypeInfo info{detail::nextTypeTag(), typeid(T).name(), sizeof(T), &detail::destroy<T>,
+                               detail::traceOf<T>()};
+    static const bool registered = (detail::typeRegistry[info.tag].store(&info, std::memory_order_release), true);
+    (void)registered;
+    return info;
+  }
+
+  /**
+   * @brief Returns the registry entry of a type tag, or nullptr for
+   * untypedTag and tags not registered
+   */
+  inline const TypeInfo* typeInfoOf(uint16_t tag) {
+    return tag < MEMPOOL_MAX_TYPE_TAGS ? detail::typeRegistry[tag].load(std::memory_order_acquire) : nullptr;
+  }
+
+  // Site of allocations made outside any AllocationScope
+  inline constexpr uint32_t noSite = 0;
+
+  namespace detail {
+    // Registered allocation site names by id
+    inline std::atomic<const char*> siteRegistry[MEMPOOL_MAX_ALLOC_SITES] = {};
+    inline std::atomic<size_t> numSites{noSite + 1};
+    // Innermost open allocation site of this thread
+    inline thread_local uint32_t currentSite = noSite;
+  }  // namespace detail
+
+  /**
+   * @brief Named allocation site, for telling apart the callers that allocate
+   * objects of the same type. Define one per call site, typically as a
+   * static, and open an AllocationScope around its allocations:
+   * 
+   *     static const AllocationSite parseSite("Parser::parseNode");
+   *     AllocationScope scope(parseSite);
+   * 
+   * With MEMPOOL_ALLOC_SITES defined, every allocation records the
+   * innermost open site of its thread, which MemPool::pinningReport lists.
+   */
+  class AllocationSite {
+  private:  // ------------------------------------------------------------
+    uint32_t id;
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Registers a site
+     * 
+     * @param name Name of the site, which must outlive every pool, e.g. a
+     * string literal
+     * @throws std::length_error If MEMPOOL_MAX_ALLOC_SITES sites exist already
+     */
+    explicit AllocationSite(const char* name) {
+      const size_t id = detail::numSites.fetch_add(1, std::memory_order_relaxed);
+      if (id >= MEMPOOL_MAX_ALLOC_SITES) {
+        throw std::length_error("Too many allocation sites, raise MEMPOOL_MAX_ALLOC_SITES");
+      }
+      this->id = (uint32_t)id;
+      detail::siteRegistry[id].store(name, std::memory_order_release);
+    }
+
+    /**
+     * @brief Returns the id allocations record for this site
+     */
+    uint32_t getId() const { return this->id; }
+  };
+
+  /**
+   * @brief Makes a site the current allocation site of this thread until the
+   * scope ends. Scopes nest.
+   */
+  class AllocationScope {
+  private:  // ------------------------------------------------------------
+    uint32_t previous;
+
+  public:  // ------------------------------------------------------------
+    explicit AllocationScope(const AllocationSite& site) : previous(detail::currentSite) {
+      detail::currentSite = site.getId();
+    }
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+    ~AllocationScope() {
+      detail::currentSite = this->previous;
+    }
+  };
+
+  /**
+   * @brief Returns the name of an allocation site id, or nullptr for noSite
+   * and ids not registered
+   */
+  inline const char* siteNameOf(uint32_t site) {
+    return site < MEMPOOL_MAX_ALLOC_SITES ? detail::siteRegistry[site].load(std::memory_order_acquire) : nullptr;
+  }
+
+  /**
+   * @brief Live object found in a sparsely occupied chunk
+   */
+  struct PinnedObject {
+    void* obj;              // The object
+    size_t size;            // Bytes reserved for it
+    const TypeInfo* type;   // Its type, nullptr if untyped
+    const char* site;       // Its allocation site, nullptr if none
+  };
+
+  /**
+   * @brief Chunk kept in use by a few live objects
+   */
+  struct PinnedChunk {
+    void* data;                         // First byte of the chunk
+    size_t used;                        // Occupied bytes, with headers and padding
+    std::vector<PinnedObject> objects;  // Live objects, in address order
+  };
+
+  /**
+   * @brief Live objects of one type and allocation site found in sparsely
+   * occupied chunks
+   */
+  struct PinningSource {
+    const TypeInfo* type;  // Their type, nullptr if untyped
+    const char* site;      // Their allocation site, nullptr if none
+    size_t objects = 0;    // Number of objects
+    size_t bytes = 0;      // Bytes reserved for them
+    size_t chunks = 0;     // Sparse chunks holding at least one of them
+    // Bytes of the sparse chunks holding nothing but them, which would be
+    // freed if they were allocated elsewhere, e.g. in a pool for long-lived
+    // objects
+    size_t recoverable = 0;
+  };
+
+  /**
+   * @brief Result of MemPool::pinningReport
+   */
+  struct PinningReport {
+    size_t chunksInUse = 0;        // Occupied chunks scanned
+    size_t chunksPinned = 0;       // Chunks at or below the occupancy threshold
+    size_t bytesPinned = 0;        // Bytes of live objects in those chunks
+    // Bytes of those chunks that would be freed by packing their objects
+    // densely into as few chunks as possible
+    size_t compactionRecoverable = 0;
+    std::vector<PinnedChunk> chunks;      // Pinned chunks, in address order
+    std::vector<PinningSource> sources;   // By recoverable bytes, then chunks, descending
+  };
+
   /**
    * @brief Heterogeneous memory pool
    * 
@@ -24,199 +658,2482 @@ namespace benpm {
   private:  // ------------------------------------------------------------
     static constexpr size_t blockSize = chunkSize * chunksPerBlock;
 
+    static_assert((chunkSize & (chunkSize - 1)) == 0, "chunkSize must be a power of 2");
+    static_assert((chunksPerBlock & (chunksPerBlock - 1)) == 0, "chunksPerBlock must be a power of 2");
+    static_assert(chunkSize <= UINT32_MAX, "chunkSize must fit in 32 bits");
+
+    struct Block;
+
+    #ifdef MEMPOOL_TYPE_TAGS
+      // Header in front of every allocation, so a chunk can be walked from
+      // allocation to allocation. 8 bytes, 16 with allocation sites, so
+      // objects stay 8 byte aligned
+      struct alignas(8) TagHeader {
+        uint32_t size;  // Bytes from the header to the end of the allocation
+        uint16_t tag;   // Type tag, or one of the reserved tags below
+        uint16_t gap;   // Padding in front of the header, in header sizes
+        #ifdef MEMPOOL_ALLOC_SITES
+          uint32_t site = noSite;  // Allocation site id, see AllocationScope
+        #endif
+      };
+      static_assert(sizeof(TagHeader) % 8 == 0, "Tag headers must keep objects 8 byte aligned");
+
+      // Reserved tags of freed allocations, of padding and of objects whose
+      // constructor has not returned yet
+      static constexpr uint16_t freeTag = 0xFFFF;
+      static constexpr uint16_t paddingTag = 0xFFFE;
+      static constexpr uint16_t constructingTag = 0xFFFD;
+
+      // Returns the tag of the allocation behind header. The thread
+      // constructing an object publishes its tag without the mutex, so walks
+      // under the mutex read it atomically
+      static uint16_t loadTag(const TagHeader* header) {
+        return __atomic_load_n(&header->tag, __ATOMIC_ACQUIRE);
+      }
+
+      // Returns the offset of an object with given alignment allocated at
+      // head, leaving room for its header
+      static constexpr size_t taggedOffset(size_t head, size_t align) {
+        return alignUp(head + sizeof(TagHeader), align > sizeof(TagHeader) ? align : sizeof(TagHeader));
+      }
+    #endif
+
+    // Returns the largest allocation with given alignment that fits in a chunk
+    static constexpr size_t capacity(size_t align) {
+      #ifdef MEMPOOL_TYPE_TAGS
+        return chunkSize - (align > sizeof(TagHeader) ? align : sizeof(TagHeader));
+      #else
+        (void)align;
+        return chunkSize;
+      #endif
+    }
+
+    // Returns the most bytes an object of given size and alignment can take
+    // from a chunk, including padding
+    static constexpr size_t worstCase(size_t size, size_t align) {
+      #ifdef MEMPOOL_TYPE_TAGS
+        return alignUp(size, sizeof(TagHeader)) + (align > sizeof(TagHeader) ? align : sizeof(TagHeader));
+      #else
+        return size + align - 1;
+      #endif
+    }
+
+    // Returns the offset of the first of a run of objects of given alignment
+    // carved from an empty chunk
+    static constexpr size_t firstOffset(size_t align) {
+      #ifdef MEMPOOL_TYPE_TAGS
+        return taggedOffset(0, align);
+      #else
+        (void)align;
+        return 0;
+      #endif
+    }
+
+    // Returns the distance between consecutive objects of given size and
+    // alignment carved from the same chunk, including tag header and padding
+    static constexpr size_t stride(size_t size, size_t align) {
+      #ifdef MEMPOOL_TYPE_TAGS
+        return alignUp(alignUp(size, sizeof(TagHeader)) + sizeof(TagHeader),
+                       align > sizeof(TagHeader) ? align : sizeof(TagHeader));
+      #else
+        return alignUp(size, align);
+      #endif
+    }
+
+    // Returns the bytes an object of given size occupies after its offset
+    static constexpr size_t footprint(size_t size) {
+      #ifdef MEMPOOL_TYPE_TAGS
+        return alignUp(size, sizeof(TagHeader));
+      #else
+        return size;
+      #endif
+    }
+
+    // Returns the bytes reserved for a request of given size. Zero-size
+    // requests still take a byte, so their pointer lies inside the chunk
+    // charged for them and freeing them cannot release that chunk twice
+    static constexpr size_t nonZero(size_t size) {
+      return size > 0 ? size : 1;
+    }
+
+    // Returns the tag recorded for objects of type T
+    template <class T>
+    static uint16_t tagOf() {
+      #ifdef MEMPOOL_TYPE_TAGS
+        return typeInfoOf<std::remove_cv_t<T>>().tag;
+      #else
+        return untypedTag;
+      #endif
+    }
+
+    // Marks the allocation at ptr as freed and returns the bytes it took
+    // from its chunk, given the size it was allocated with
+    static size_t untag(void* ptr, size_t size) {
+      #ifdef MEMPOOL_TYPE_TAGS
+        (void)size;
+        TagHeader* header = (TagHeader*)ptr - 1;
+        header->tag = freeTag;
+        return header->gap * sizeof(TagHeader) + header->size;
+      #else
+        (void)ptr;
+        return nonZero(size);
+      #endif
+    }
+
+    // Chunk metadata. This lives in the header of the chunk's block rather than
+    // in the chunk itself, so that chunks are pure payload and walking chunk
+    // state only touches the block header.
     struct Chunk {
-      char* head;   // Next free byte in chunk
-      Chunk* next;  // Next free chunk
-      size_t used;  // Occupied bytes in chunk
+      uint32_t head;  // Offset of next free byte in chunk
+      uint32_t used;  // Occupied bytes in chunk
+      uint32_t dirty; // Offset from which the chunk is still zero since mapping
+      #ifdef MEMPOOL_GC
+        uint32_t sweepEnd;  // Offset up to which the pending sweep walks the chunk
+      #endif
+      Chunk* next;    // Next chunk in the free list or occupancy bin
+      Chunk* prev;    // Previous chunk in the occupancy bin
 
       // Initialize chunk
       void init(Chunk* next) {
         this->next = next;
-        this->used = sizeof(Chunk);
-        this->head = ((char*)this) + sizeof(Chunk);
+        this->prev = nullptr;
+        this->used = 0;
+        this->head = 0;
+        this->dirty = 0;
+        #ifdef MEMPOOL_GC
+          this->sweepEnd = 0;
+        #endif
       }
       // Returns if chunk is empty and can be used for more allocations
-      bool empty() const { return this->used == sizeof(Chunk); }
-      // Emplace object of type T in chunk
-      template <class T, class... V> 
-      std::shared_ptr<T> makeShared(MemPool* pool, V&&... v) {
-        return std::shared_ptr<T>(
-          this->make<T>(pool, std::forward<V>(v)...),
-          [pool,this](T* o){ pool->template destructHandler<T>(this, o); });
-      }
-
-      template <class T, class... V>
-      T* make(MemPool* pool, V&&... v) {
-        static_assert(sizeof(T) <= chunkSize - sizeof(Chunk), "Object is too large for chunk");
-        T* obj = new (head) T(std::forward<V>(v)...);
-        this->head += sizeof(T);
-        this->used += sizeof(T);
-        return obj;
+      bool empty() const { return this->used == 0; }
+      // Returns the first byte of this chunk's payload
+      char* data() const {
+        Block* block = blockOf(this);
+        return (char*)block + (size_t)(this - block->chunks) * chunkSize;
+      }
+      // Returns if an object of given size and alignment fits after head
+      bool fits(size_t size, size_t align) const {
+        #ifdef MEMPOOL_TYPE_TAGS
+          return taggedOffset(this->head, align) + alignUp(size, sizeof(TagHeader)) <= chunkSize;
+        #else
+          return alignUp(this->head, align) + size <= chunkSize;
+        #endif
+      }
+      // Reserve size bytes with given alignment in chunk, for an object with
+      // given type tag
+      void* alloc(size_t size, size_t align, uint16_t tag) {
+        #ifdef MEMPOOL_TYPE_TAGS
+          // A padding record fills any gap, so headers follow each other
+          const size_t start = this->head;
+          const size_t offset = taggedOffset(start, align);
+          const size_t end = offset + alignUp(size, sizeof(TagHeader));
+          const size_t header = offset - sizeof(TagHeader);
+          if (header > start) {
+            new (this->data() + start) TagHeader{(uint32_t)(header - start), paddingTag, 0};
+          }
+          new (this->data() + header) TagHeader{(uint32_t)(end - header), tag,
+                                                (uint16_t)((header - start) / sizeof(TagHeader))};
+          #ifdef MEMPOOL_ALLOC_SITES
+            ((TagHeader*)(this->data() + header))->site = detail::currentSite;
+          #endif
+          this->head = (uint32_t)end;
+          this->used += (uint32_t)(end - start);
+        #else
+          (void)tag;
+          const size_t offset = alignUp(this->head, align);
+          this->head = (uint32_t)(offset + size);
+          this->used += (uint32_t)size;
+        #endif
+        this->dirty = this->head > this->dirty ? this->head : this->dirty;
+        return this->data() + offset;
+      }
+    };
+
+    // Block header, stored in the first chunk(s) of each block. Holds the
+    // metadata of every chunk in the block densely, so scanning chunk state
+    // touches a few cache lines instead of one page per chunk.
+    struct Block {
+      MemPool* pool;  // Owning pool, must stay the first member (see ownerOf)
+      uint64_t emptyMask[(chunksPerBlock + 63) / 64];  // Empty chunks, for ChunkPolicy::LowestAddress
+      Block* emptyChild;  // Links in the pool's heap of blocks with empty chunks
+      Block* emptySibling;
+      std::atomic<uint64_t> dirtyMask[(chunksPerBlock + 63) / 64];  // Chunks changed since the last checkpoint
+      #ifdef MEMPOOL_GC
+        // Mark bits of each chunk, one per tag header sized granule
+        uint64_t markBits[chunksPerBlock][(chunkSize / sizeof(TagHeader) + 63) / 64];
+      #endif
+      Chunk chunks[chunksPerBlock];  // Entries below headerChunks are unused
+    };
+
+    static_assert(offsetof(Block, pool) == 0, "Blocks must start with their owning pool");
+
+    // Number of leading chunks in each block occupied by the block header.
+    // Rounding the header up to whole chunks keeps every chunk the same
+    // shape, so payloads start at offset 0 and heads reset to 0. It costs
+    // 1 / chunksPerBlock of the address space, but only the header's own
+    // pages are written, so the rest of the chunk is never faulted in
+    static constexpr size_t headerChunks = (sizeof(Block) + chunkSize - 1) / chunkSize;
+    static_assert(headerChunks < chunksPerBlock, "Block header does not leave room for any chunks");
+
+    // Number of occupancy bins for partially occupied chunks
+    static constexpr size_t numBins = 64;
+    // Range of remaining bytes covered by each occupancy bin
+    static constexpr size_t binWidth = chunkSize / numBins > 0 ? chunkSize / numBins : 1;
+
+    // Mutex for thread safety, on a cache line of its own so that waiting
+    // threads do not disturb the allocation state below
+    alignas(cacheLineSize) mutable std::mutex mutex;
+    // Non-full chunk which is currently being used
+    alignas(cacheLineSize) Chunk* curChunk = nullptr;
+    // How the next chunk is picked
+    const ChunkPolicy policy;
+    // Whether new blocks may be allocated when all chunks are in use
+    bool growable = true;
+    // Whether a checkpoint was saved since the blocks were last replaced, so
+    // an incremental one can follow
+    bool checkpointed = false;
+    // Singly linked list of empty chunks, not including curChunk
+    Chunk* freeChunk = nullptr;
+    // Pairing heap of the blocks with empty chunks, lowest address on top,
+    // for ChunkPolicy::LowestAddress. A block is in it while its emptyMask is
+    // non-zero
+    Block* emptyBlocks = nullptr;
+    // Doubly linked lists of retired, partially occupied chunks binned by
+    // remaining bytes, for ChunkPolicy::BestFit
+    Chunk* bins[numBins] = {};
+    // Bit i is set if bins[i] is non-empty
+    uint64_t binMask = 0;
+    // Chunk turnover counters
+    PoolStats stats;
+    // Map from block index to block pointer
+    std::unordered_map<size_t, Block*> blocks;
+    // Stack of memory freed by other threads, reclaimed when the owner next
+    // switches chunks. Each entry is linked through the freed memory itself
+    alignas(cacheLineSize) std::atomic<void*> remoteFrees{nullptr};
+    #ifdef MEMPOOL_GC
+      // Registered root pointer variables
+      std::vector<void**> roots;
+      // Chunks still to sweep after the last mark, from sweepPos on
+      std::vector<Chunk*> sweepQueue;
+      size_t sweepPos = 0;
+    #endif
+    #ifdef MEMPOOL_MEMFD
+      // File holding the blocks once snapshots are enabled, else null
+      std::shared_ptr<detail::BackingFile> backing;
+      // Offset of each block in the backing file, by block index
+      std::unordered_map<size_t, uint64_t> blockOffsets;
+      // Whether blocks are mapped copy-on-write, so writes since the last
+      // snapshot stay out of the backing file
+      bool copyOnWrite = false;
+    #endif
+
+    // Bound, called for a particular chunk and object when shared_ptr ref count
+    // hits 0. The destructor runs before locking, so it may free members
+    // allocated in this pool
+    template <class T>
+    void destructHandler(Chunk* chunk, T* obj, size_t size) {
+      // assert(this->contains(obj));
+      // assert(this->inChunk(obj, chunk));
+      obj->~T();
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(this->mutex);
+      #endif
+      this->release(chunk, untag(obj, size));
+    }
+
+    // Returns size bytes to chunk, making it available again once it empties.
+    // Must be called with the mutex held
+    void release(Chunk* chunk, size_t size) {
+      assert(chunk->used >= size);
+      markDirty(chunk);
+      chunk->used -= (uint32_t)size;
+      if (chunk->empty()) {
+        #ifdef MEMPOOL_GC
+          // Nothing left for the pending sweep, and reuse must not be swept
+          chunk->sweepEnd = 0;
+        #endif
+        this->stats.chunksRecycled++;
+        if (chunk == this->curChunk) {
+          // Already in use, can keep bumping from the start
+          chunk->head = 0;
+          return;
+        }
+        if (this->policy == ChunkPolicy::BestFit) {
+          this->unbin(chunk);
+        }
+        chunk->head = 0;
+        this->pushEmpty(chunk);
+      }
+    }
+
+    // Records that a chunk changed since the last checkpoint. Lock-free
+    static void markDirty(const Chunk* chunk) {
+      Block* block = blockOf(chunk);
+      const size_t i = chunk - block->chunks;
+      block->dirtyMask[i / 64].fetch_or((uint64_t)1 << (i % 64), std::memory_order_relaxed);
+    }
+
+    // Returns the occupancy bin of a chunk with given remaining bytes. Bin 0
+    // is never used, since its chunks may not fit anything
+    static size_t binOf(size_t remaining) {
+      return remaining / binWidth;
+    }
+
+    // Adds a retired, partially occupied chunk to its occupancy bin
+    void bin(Chunk* chunk) {
+      const size_t b = binOf(chunkSize - chunk->head);
+      if (b == 0) {
+        return;
+      }
+      chunk->prev = nullptr;
+      chunk->next = this->bins[b];
+      if (chunk->next != nullptr) {
+        chunk->next->prev = chunk;
+      }
+      this->bins[b] = chunk;
+      this->binMask |= (uint64_t)1 << b;
+    }
+
+    // Removes a retired, partially occupied chunk from its occupancy bin
+    void unbin(Chunk* chunk) {
+      const size_t b = binOf(chunkSize - chunk->head);
+      if (b == 0) {
+        return;
+      }
+      if (chunk->prev != nullptr) {
+        chunk->prev->next = chunk->next;
+      } else {
+        this->bins[b] = chunk->next;
+      }
+      if (chunk->next != nullptr) {
+        chunk->next->prev = chunk->prev;
+      }
+      if (this->bins[b] == nullptr) {
+        this->binMask &= ~((uint64_t)1 << b);
+      }
+    }
+
+    // Takes the partially occupied chunk from the lowest occupancy bin that is
+    // guaranteed to fit the given size and alignment, or returns nullptr
+    Chunk* takePartial(size_t size, size_t align) {
+      const size_t b = (worstCase(size, align) + binWidth - 1) / binWidth;
+      if (b >= numBins) {
+        return nullptr;
+      }
+      const uint64_t candidates = this->binMask & (~(uint64_t)0 << b);
+      if (candidates == 0) {
+        return nullptr;
+      }
+      Chunk* chunk = this->bins[__builtin_ctzll(candidates)];
+      this->unbin(chunk);
+      return chunk;
+    }
+
+    // Joins two pairing heaps of blocks, either of which may be null
+    static Block* meldBlocks(Block* a, Block* b) {
+      if (a == nullptr) {
+        return b;
+      }
+      if (b == nullptr) {
+        return a;
+      }
+      if (b < a) {
+        std::swap(a, b);
+      }
+      b->emptySibling = a->emptyChild;
+      a->emptyChild = b;
+      return a;
+    }
+
+    // Removes the lowest block from the heap of blocks with empty chunks,
+    // pairing its children left to right, then melding the pairs right to left
+    void popEmptyBlock() {
+      Block* child = this->emptyBlocks->emptyChild;
+      Block* pairs = nullptr;
+      while (child != nullptr) {
+        Block* a = child;
+        Block* b = a->emptySibling;
+        child = b != nullptr ? b->emptySibling : nullptr;
+        a->emptySibling = nullptr;
+        if (b != nullptr) {
+          b->emptySibling = nullptr;
+          a = meldBlocks(a, b);
+        }
+        a->emptySibling = pairs;
+        pairs = a;
+      }
+      Block* root = nullptr;
+      while (pairs != nullptr) {
+        Block* next = pairs->emptySibling;
+        pairs->emptySibling = nullptr;
+        root = meldBlocks(root, pairs);
+        pairs = next;
+      }
+      this->emptyBlocks = root;
+    }
+
+    // Makes an empty chunk available for reuse
+    void pushEmpty(Chunk* chunk) {
+      if (this->policy == ChunkPolicy::LowestAddress) {
+        Block* block = blockOf(chunk);
+        const size_t i = (size_t)(chunk - block->chunks);
+        bool hasEmpty = false;
+        for (uint64_t mask : block->emptyMask) {
+          hasEmpty |= mask != 0;
+        }
+        block->emptyMask[i / 64] |= (uint64_t)1 << (i % 64);
+        if (!hasEmpty) {
+          block->emptyChild = nullptr;
+          block->emptySibling = nullptr;
+          this->emptyBlocks = meldBlocks(this->emptyBlocks, block);
+        }
+      } else {
+        chunk->next = this->freeChunk;
+        this->freeChunk = chunk;
+      }
+    }
+
+    // Takes an empty chunk according to the policy, or returns nullptr
+    Chunk* takeEmpty() {
+      if (this->policy == ChunkPolicy::LowestAddress) {
+        if (this->emptyBlocks == nullptr) {
+          return nullptr;
+        }
+        Block* block = this->emptyBlocks;
+        size_t w = 0;
+        while (block->emptyMask[w] == 0) {
+          w++;
+        }
+        const size_t i = w * 64 + __builtin_ctzll(block->emptyMask[w]);
+        block->emptyMask[w] &= block->emptyMask[w] - 1;
+        bool hasEmpty = false;
+        for (uint64_t mask : block->emptyMask) {
+          hasEmpty |= mask != 0;
+        }
+        if (!hasEmpty) {
+          this->popEmptyBlock();
+        }
+        return &block->chunks[i];
+      }
+      Chunk* chunk = this->freeChunk;
+      if (chunk != nullptr) {
+        this->freeChunk = chunk->next;
+      }
+      return chunk;
+    }
+
+    // Returns true if a chunk fitting an object of given size and alignment
+    // is available without allocating a block
+    bool canTake(size_t size, size_t align) const {
+      if (this->curChunk != nullptr && this->curChunk->empty()) {
+        return true;
+      }
+      if (this->policy == ChunkPolicy::LowestAddress ? this->emptyBlocks != nullptr : this->freeChunk != nullptr) {
+        return true;
+      }
+      if (this->policy == ChunkPolicy::BestFit) {
+        const size_t b = (worstCase(size, align) + binWidth - 1) / binWidth;
+        return b < numBins && (this->binMask & (~(uint64_t)0 << b)) != 0;
+      }
+      return false;
+    }
+
+    // Retires the current chunk and picks the next one to fit an object of
+    // given size and alignment, allocating a new block if there is none
+    void nextChunk(size_t size, size_t align) {
+      this->drainRemote();
+      if (!this->growable && !this->canTake(size, align)) {
+        // Fail before retiring the current chunk, which stays usable
+        throw std::bad_alloc();
+      }
+      // Pick the next chunk before retiring the current one, so that if
+      // allocating a block throws, the current chunk stays usable and is not
+      // also on the free list or in a bin
+      Chunk* chunk = nullptr;
+      if (this->policy == ChunkPolicy::BestFit) {
+        chunk = this->takePartial(size, align);
+      }
+      if (chunk == nullptr) {
+        chunk = this->takeEmpty();
+      }
+      if (chunk == nullptr && this->curChunk != nullptr && this->curChunk->empty()) {
+        // Keep bumping from the start rather than growing
+        chunk = this->curChunk;
+      }
+      if (chunk == nullptr) {
+        this->allocBlock();
+        chunk = this->takeEmpty();
+      }
+      if (this->curChunk != nullptr && this->curChunk != chunk) {
+        if (this->curChunk->empty()) {
+          this->pushEmpty(this->curChunk);
+        } else if (this->policy == ChunkPolicy::BestFit) {
+          this->bin(this->curChunk);
+        }
+        // Otherwise the chunk is not tracked until it empties
+      }
+      this->curChunk = chunk;
+      this->stats.chunksTaken++;
+      markDirty(chunk);
+    }
+
+    // Smallest allocation freeRemote can link into the remote free stack
+    static constexpr size_t remoteMinSize = sizeof(void*) + sizeof(uint32_t);
+
+    // Pushes size bytes at ptr onto the remote free stack, which must be at
+    // least remoteMinSize, as checked by the callers. Lock-free
+    void pushRemote(void* ptr, size_t size) {
+      assert(size >= remoteMinSize);
+      const uint32_t size32 = (uint32_t)size;
+      void* head = this->remoteFrees.load(std::memory_order_relaxed);
+      do {
+        // The memory may be unaligned for a pointer, so copy byte-wise
+        std::memcpy(ptr, &head, sizeof(void*));
+        std::memcpy((char*)ptr + sizeof(void*), &size32, sizeof(uint32_t));
+      } while (!this->remoteFrees.compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Releases everything on the remote free stack. Must be called by the
+    // owning thread, or with the mutex held
+    void drainRemote() {
+      void* ptr = this->remoteFrees.exchange(nullptr, std::memory_order_acquire);
+      while (ptr != nullptr) {
+        void* next;
+        uint32_t size;
+        std::memcpy(&next, ptr, sizeof(void*));
+        std::memcpy(&size, (char*)ptr + sizeof(void*), sizeof(uint32_t));
+        this->release(chunkOf(ptr), untag(ptr, size));
+        ptr = next;
+      }
+    }
+
+    // Allocates a new block of chunks
+    void allocBlock() {
+      Block* block = (Block*)detail::mapBlock(blockSize);
+      // assert((size_t)(char*)block % blockSize == 0);
+      #ifdef MEMPOOL_MEMFD
+        if (this->backing) {
+          try {
+            this->attachBlock(block, false);
+          } catch (...) {
+            detail::unmapBlock(block, blockSize);
+            throw;
+          }
+        }
+      #endif
+      block->pool = this;
+      for (uint64_t& mask : block->emptyMask) {
+        mask = 0;
+      }
+      // A new block is part of the next checkpoint even if none of its
+      // chunks are used, through the bit of its first header chunk
+      markDirty(&block->chunks[0]);
+      // Push in reverse so the lowest chunk is handed out first
+      for (size_t i = chunksPerBlock; i-- > headerChunks;) {
+        block->chunks[i].init(nullptr);
+        this->pushEmpty(&block->chunks[i]);
+      }
+      // assert(blocks.count(getBlockIdx(block)) == 0);
+      blocks.emplace(getBlockIdx(block), block);
+    }
+
+    #ifdef MEMPOOL_MEMFD
+      // Moves a block into a region of the backing file, copying its
+      // contents if copy
+      void attachBlock(Block* block, bool copy) {
+        const uint64_t offset = this->backing->acquire();
+        try {
+          if (copy) {
+            this->backing->write(block, blockSize, offset);
+          }
+          this->backing->map(block, blockSize, offset, this->copyOnWrite);
+        } catch (...) {
+          this->backing->release(offset);
+          throw;
+        }
+        this->blockOffsets[getBlockIdx(block)] = offset;
+      }
+
+      // Drops the pool's hold on the backing file
+      void detachBacking() {
+        for (const auto& it : this->blockOffsets) {
+          this->backing->release(it.second);
+        }
+        this->blockOffsets.clear();
+        this->backing.reset();
+      }
+
+      // Brings the backing file up to date with the blocks. A block written
+      // since the last snapshot is updated in place, with only its copied
+      // pages, unless a snapshot still reads its region: then the block is
+      // written to a new region instead. Blocks left untouched stay shared
+      void syncBacking() {
+        if (!this->copyOnWrite) {
+          return;
+        }
+        const int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+        std::unique_ptr<const int, void (*)(const int*)> closer(&pagemap, [](const int* fd) {
+          if (*fd >= 0) {
+            close(*fd);
+          }
+        });
+        std::vector<std::pair<size_t, size_t>> runs;
+        for (const auto& it : this->blocks) {
+          char* block = (char*)it.second;
+          uint64_t& offset = this->blockOffsets.at(it.first);
+          runs.clear();
+          const bool scanned = pagemap >= 0 && detail::forEachCopiedPage(pagemap, block, blockSize, [&](size_t at, size_t n) {
+            runs.emplace_back(at, n);
+          });
+          if (scanned && runs.empty()) {
+            continue;
+          }
+          if (this->backing->shared(offset)) {
+            const uint64_t fresh = this->backing->acquire();
+            try {
+              this->backing->write(block, blockSize, fresh);
+            } catch (...) {
+              this->backing->release(fresh);
+              throw;
+            }
+            this->backing->release(offset);
+            offset = fresh;
+          } else if (scanned) {
+            for (const auto& run : runs) {
+              this->backing->write(block + run.first, run.second, offset + run.first);
+            }
+          } else {
+            this->backing->write(block, blockSize, offset);
+          }
+        }
+      }
+    #endif
+
+    // Rounds offset up to a multiple of align (a power of 2)
+    static constexpr size_t alignUp(size_t offset, size_t align) {
+      return (offset + align - 1) & ~(align - 1);
+    }
+
+    // Returns the block containing a memory address. Also works for chunk
+    // metadata, since it lives in the block header.
+    static Block* blockOf(const void* ptr) {
+      return (Block*)((uintptr_t)ptr & ~(uintptr_t)(blockSize - 1));
+    }
+
+    // Returns the metadata of the chunk containing a memory address
+    static Chunk* chunkOf(const void* ptr) {
+      Block* block = blockOf(ptr);
+      return &block->chunks[((uintptr_t)ptr & (blockSize - 1)) / chunkSize];
+    }
+
+    // Returns the block index of a memory address
+    size_t getBlockIdx(void* ptr) const {
+      return (size_t)(char*)ptr / blockSize;
+    }
+
+    // Returns true if given memory address resides in this pool
+    bool contains(void* ptr) const {
+      return this->blocks.count(this->getBlockIdx(ptr));
+    }
+
+    // Returns true if given memory address resides in given chunk
+    bool inChunk(void* ptr, Chunk* chunk) const {
+      return (char*)ptr >= chunk->data() &&
+            (char*)ptr < chunk->data() + chunkSize;
+    }
+
+    // Bytes reserved for an object of type T allocated with makeIsolated
+    template <class T>
+    static constexpr size_t isolatedSize() {
+      return alignUp(sizeof(T), cacheLineSize);
+    }
+
+    // Alignment of an object of type T allocated with makeIsolated
+    template <class T>
+    static constexpr size_t isolatedAlign() {
+      return cacheLineSize > alignof(T) ? cacheLineSize : alignof(T);
+    }
+
+    // Bytes reserved for an object of type T with extra bytes of trailing
+    // storage. Throws std::bad_alloc if they do not fit in a chunk
+    template <class T>
+    static size_t trailingSize(size_t extra) {
+      if (extra > capacity(allocAlign<T>()) - sizeof(T)) {
+        throw std::bad_alloc();
+      }
+      const size_t size = sizeof(T) + extra;
+      const size_t padded = CacheIsolated<T>::value ? alignUp(size, cacheLineSize) : size;
+      if (padded > capacity(allocAlign<T>())) {
+        throw std::bad_alloc();
+      }
+      return padded;
+    }
+
+    // Emplace object of type T in the current chunk, reserving size bytes with
+    // given alignment. The constructor runs after unlocking, so it may
+    // allocate members in this pool
+    template <class T, class... V>
+    T* emplace(size_t size, size_t align, V&&... v) {
+      const uint16_t tag = tagOf<T>();
+      size = nonZero(size);
+      void* ptr;
+      {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        if (!this->curChunk->fits(size, align)) {
+          this->nextChunk(size, align);
+        }
+        #ifdef MEMPOOL_TYPE_TAGS
+          // Walks skip the object until it is constructed
+          ptr = this->curChunk->alloc(size, align, constructingTag);
+        #else
+          ptr = this->curChunk->alloc(size, align, tag);
+        #endif
+      }
+      T* obj;
+      try {
+        obj = new (ptr) T(std::forward<V>(v)...);
+      } catch (...) {
+        this->deallocate(ptr, size);
+        throw;
+      }
+      #ifdef MEMPOOL_TYPE_TAGS
+        __atomic_store_n(&((TagHeader*)ptr - 1)->tag, tag, __ATOMIC_RELEASE);
+      #endif
+      return obj;
+    }
+
+    // Snapshot file header, followed by the old block addresses, the old
+    // addresses of the saved chunks (incremental snapshots only), the
+    // relocation table, the roots, the type and site name tables and, page
+    // aligned, the blocks or chunks
+    struct SnapshotHeader {
+      char magic[8];
+      uint64_t chunkBytes;
+      uint64_t blockChunks;
+      uint64_t layout;  // layoutFlags of the saving pool
+      uint64_t numBlocks;
+      uint64_t numChunks;
+      uint64_t numRelocs;
+      uint64_t numRoots;
+      uint64_t numTypeWords;
+      uint64_t numSiteWords;
+      uint64_t dataOffset;
+    };
+
+    static constexpr char snapshotMagic[8] = {'B', 'E', 'N', 'P', 'M', 'P', 'L', '2'};
+    static constexpr char incrementMagic[8] = {'B', 'E', 'N', 'P', 'M', 'P', 'I', '2'};
+
+    // Configuration changing the layout of blocks and allocations, which a
+    // snapshot must have been saved with to be loaded
+    static constexpr uint64_t layoutFlags = 0
+      #ifdef MEMPOOL_TYPE_TAGS
+        | 1
+      #endif
+      #ifdef MEMPOOL_ALLOC_SITES
+        | 2
+      #endif
+      #ifdef MEMPOOL_GC
+        | 4
+      #endif
+      ;
+
+    // Tables of a snapshot file, all sorted except the roots
+    struct SnapshotTables {
+      SnapshotHeader header;
+      std::vector<uint64_t> addresses;
+      std::vector<uint64_t> chunks;
+      std::vector<uint64_t> relocs;
+      std::vector<uint64_t> roots;
+      std::vector<uint64_t> types;  // Type names by tag, see packNames
+      std::vector<uint64_t> sites;  // Site names by id, see packNames
+    };
+
+    // Packs the names of ids [1, count) as id, length, and the name padded
+    // to 8 byte words, skipping ids without a name. Tags and site ids are
+    // handed out in first use order, so a snapshot carries their names to
+    // be mapped to the ids of the loading process
+    template <class F>
+    static std::vector<uint64_t> packNames(size_t count, F nameOf) {
+      std::vector<uint64_t> table;
+      for (size_t id = 1; id < count; id++) {
+        const char* name = nameOf(id);
+        if (name == nullptr) {
+          continue;
+        }
+        const size_t length = std::strlen(name);
+        table.push_back(id);
+        table.push_back(length);
+        const size_t at = table.size();
+        table.resize(at + (length + 7) / 8, 0);
+        std::memcpy(&table[at], name, length);
+      }
+      return table;
+    }
+
+    // Unpacks a table written by packNames into id to name
+    static std::unordered_map<uint64_t, std::string> unpackNames(const std::vector<uint64_t>& table) {
+      std::unordered_map<uint64_t, std::string> names;
+      for (size_t i = 0; i < table.size();) {
+        if (table.size() - i < 2 || table[i + 1] > 8 * (table.size() - i - 2)) {
+          throw std::runtime_error("Pool snapshot name table is corrupt");
+        }
+        names[table[i]].assign((const char*)&table[i + 2], table[i + 1]);
+        i += 2 + (table[i + 1] + 7) / 8;
+      }
+      return names;
+    }
+
+    #ifdef MEMPOOL_TYPE_TAGS
+      // Walks every allocation header of loaded blocks, checking that they
+      // chain up to each chunk's head, and rewrites saved tags and site ids
+      // to the ones this process registered under the same names
+      static void remapTags(const std::vector<Block*>& loaded, const std::vector<uint64_t>& types,
+                            const std::vector<uint64_t>& sites) {
+        std::unordered_map<std::string, uint16_t> localTypes;
+        for (size_t tag = untypedTag + 1; tag < detail::numTypeTags.load() && tag < MEMPOOL_MAX_TYPE_TAGS; tag++) {
+          if (const TypeInfo* type = typeInfoOf((uint16_t)tag)) {
+            localTypes.emplace(type->name, (uint16_t)tag);
+          }
+        }
+        // Saved tag to local tag, or freeTag for types this process has not
+        // registered
+        std::unordered_map<uint64_t, uint16_t> typeMap{{untypedTag, untypedTag}};
+        for (const auto& it : unpackNames(types)) {
+          auto local = localTypes.find(it.second);
+          typeMap[it.first] = local != localTypes.end() ? local->second : freeTag;
+        }
+        #ifdef MEMPOOL_ALLOC_SITES
+          std::unordered_map<std::string, uint32_t> localSites;
+          for (size_t id = noSite + 1; id < detail::numSites.load() && id < MEMPOOL_MAX_ALLOC_SITES; id++) {
+            if (const char* name = siteNameOf((uint32_t)id)) {
+              localSites.emplace(name, (uint32_t)id);
+            }
+          }
+          // Sites only label diagnostics, so unknown ones become noSite
+          std::unordered_map<uint64_t, uint32_t> siteMap;
+          for (const auto& it : unpackNames(sites)) {
+            auto local = localSites.find(it.second);
+            siteMap[it.first] = local != localSites.end() ? local->second : noSite;
+          }
+        #else
+          (void)sites;
+        #endif
+        for (Block* block : loaded) {
+          for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+            const Chunk& chunk = block->chunks[i];
+            if (chunk.empty()) {
+              continue;
+            }
+            char* data = (char*)block + i * chunkSize;
+            for (size_t pos = 0; pos < chunk.head;) {
+              TagHeader* header = (TagHeader*)(data + pos);
+              if (header->size < sizeof(TagHeader) || header->size % sizeof(TagHeader) != 0 ||
+                  header->size > chunk.head - pos || header->gap * sizeof(TagHeader) > pos) {
+                throw std::runtime_error("Pool snapshot has corrupt allocation headers");
+              }
+              pos += header->size;
+              if (header->tag == freeTag || header->tag == paddingTag) {
+                continue;
+              }
+              auto type = typeMap.find(header->tag);
+              if (type == typeMap.end()) {
+                throw std::runtime_error("Pool snapshot has corrupt allocation headers");
+              }
+              if (type->second == freeTag) {
+                throw std::runtime_error("Pool snapshot holds objects of a type not registered in this process, see "
+                                         "typeInfoOf");
+              }
+              header->tag = type->second;
+              #ifdef MEMPOOL_ALLOC_SITES
+                auto site = siteMap.find(header->site);
+                header->site = site != siteMap.end() ? site->second : noSite;
+              #endif
+            }
+          }
+        }
+      }
+    #endif
+
+    // Returns whether a chunk changed since the last checkpoint
+    static bool isDirty(const Block* block, size_t i) {
+      return block->dirtyMask[i / 64].load(std::memory_order_relaxed) & ((uint64_t)1 << (i % 64));
+    }
+
+    // Writes every block, or with incremental only the chunks changed since
+    // the last checkpoint, then starts a new checkpoint. Must be called with
+    // the mutex held
+    void writeSnapshot(const char* path, bool incremental, const Relocations& relocations,
+                       const std::vector<void*>& roots) {
+      this->drainRemote();
+      std::vector<uint64_t> addresses;
+      for (const auto& it : this->blocks) {
+        addresses.push_back((uint64_t)(uintptr_t)it.second);
+      }
+      std::sort(addresses.begin(), addresses.end());
+      std::vector<uint64_t> chunks;
+      if (incremental) {
+        for (uint64_t address : addresses) {
+          const Block* block = (const Block*)(uintptr_t)address;
+          bool changed = false;
+          for (const auto& mask : block->dirtyMask) {
+            changed = changed || mask.load(std::memory_order_relaxed) != 0;
+          }
+          // The header holds the metadata of every chunk, so it is saved
+          // whenever any of them changed
+          for (size_t i = 0; changed && i < chunksPerBlock; i++) {
+            if (i < headerChunks || isDirty(block, i)) {
+              chunks.push_back(address + i * chunkSize);
+            }
+          }
+        }
+      }
+      // Sorted, so load patches memory in one ascending pass. Increments
+      // only carry the fields in the chunks they save
+      std::vector<uint64_t> relocs;
+      for (uintptr_t field : relocations.fields) {
+        if (!incremental || (this->contains((void*)field) && isDirty(blockOf((void*)field), (field & (blockSize - 1)) / chunkSize))) {
+          relocs.push_back(field);
+        }
+      }
+      std::sort(relocs.begin(), relocs.end());
+      std::vector<uint64_t> rootValues;
+      for (void* root : roots) {
+        rootValues.push_back((uint64_t)(uintptr_t)root);
+      }
+      SnapshotHeader header;
+      std::memcpy(header.magic, incremental ? incrementMagic : snapshotMagic, sizeof(header.magic));
+      std::vector<uint64_t> types;
+      std::vector<uint64_t> sites;
+      #ifdef MEMPOOL_TYPE_TAGS
+        types = packNames(detail::numTypeTags.load(std::memory_order_relaxed), [](size_t tag) {
+          const TypeInfo* type = tag < MEMPOOL_MAX_TYPE_TAGS ? typeInfoOf((uint16_t)tag) : nullptr;
+          return type != nullptr ? type->name : nullptr;
+        });
+      #endif
+      #ifdef MEMPOOL_ALLOC_SITES
+        sites = packNames(detail::numSites.load(std::memory_order_relaxed), [](size_t id) { return siteNameOf((uint32_t)id); });
+      #endif
+      header.chunkBytes = chunkSize;
+      header.blockChunks = chunksPerBlock;
+      header.layout = layoutFlags;
+      header.numBlocks = addresses.size();
+      header.numChunks = chunks.size();
+      header.numRelocs = relocs.size();
+      header.numRoots = rootValues.size();
+      header.numTypeWords = types.size();
+      header.numSiteWords = sites.size();
+      const size_t tables = sizeof(header) + 8 * (addresses.size() + chunks.size() + relocs.size() + rootValues.size() +
+                                                  types.size() + sites.size());
+      // Align block data for mapping
+      const size_t align = blockSize < 65536 ? blockSize : 65536;
+      header.dataOffset = alignUp(tables, align);
+
+      std::FILE* file = std::fopen(path, "wb");
+      if (file == nullptr) {
+        throw std::system_error(errno, std::generic_category(), path);
+      }
+      bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+      for (const std::vector<uint64_t>* table : {&addresses, &chunks, &relocs, &rootValues, &types, &sites}) {
+        ok = ok && (table->empty() || std::fwrite(table->data(), 8, table->size(), file) == table->size());
+      }
+      static const char zeros[4096] = {};
+      for (size_t pad = header.dataOffset - tables; ok && pad > 0;) {
+        const size_t n = pad < sizeof(zeros) ? pad : sizeof(zeros);
+        ok = std::fwrite(zeros, 1, n, file) == n;
+        pad -= n;
+      }
+      if (incremental) {
+        for (size_t i = 0; ok && i < chunks.size(); i++) {
+          ok = std::fwrite((const void*)(uintptr_t)chunks[i], 1, chunkSize, file) == chunkSize;
+        }
+      } else {
+        for (size_t i = 0; ok && i < addresses.size(); i++) {
+          ok = std::fwrite((const void*)(uintptr_t)addresses[i], 1, blockSize, file) == blockSize;
+        }
+      }
+      const int error = errno;
+      if (std::fclose(file) != 0 || !ok) {
+        throw std::system_error(ok ? errno : error, std::generic_category(), path);
+      }
+
+      for (const auto& it : this->blocks) {
+        for (auto& mask : it.second->dirtyMask) {
+          mask.store(0, std::memory_order_relaxed);
+        }
+      }
+      // Allocations keep landing in the current chunk
+      markDirty(this->curChunk);
+      this->checkpointed = true;
+    }
+
+    // Reads the tables of a snapshot file, checking it is complete
+    static SnapshotTables readSnapshot(std::FILE* file, bool incremental) {
+      SnapshotTables tables;
+      SnapshotHeader& header = tables.header;
+      if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+          std::memcmp(header.magic, incremental ? incrementMagic : snapshotMagic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(incremental ? "Not an incremental pool snapshot" : "Not a pool snapshot");
+      }
+      if (header.chunkBytes != chunkSize || header.blockChunks != chunksPerBlock) {
+        throw std::runtime_error("Pool snapshot has a different chunkSize or chunksPerBlock");
+      }
+      if (header.layout != layoutFlags) {
+        throw std::runtime_error("Pool snapshot was saved with different MEMPOOL_TYPE_TAGS, MEMPOOL_ALLOC_SITES or MEMPOOL_GC settings");
+      }
+      // Check the counts against the file size before sizing anything by
+      // them. Mapping past the end of the file would fault on first access
+      const uint64_t size = std::fseek(file, 0, SEEK_END) == 0 ? (uint64_t)std::ftell(file) : 0;
+      const uint64_t limit = size / 8;
+      if (header.numBlocks > limit || header.numChunks > limit || header.numRelocs > limit || header.numRoots > limit ||
+          header.numTypeWords > limit || header.numSiteWords > limit ||
+          sizeof(header) + 8 * (header.numBlocks + header.numChunks + header.numRelocs + header.numRoots +
+                                header.numTypeWords + header.numSiteWords) > header.dataOffset ||
+          header.dataOffset > size ||
+          (incremental ? header.numChunks : header.numBlocks) > (size - header.dataOffset) / (incremental ? chunkSize : blockSize) ||
+          std::fseek(file, sizeof(header), SEEK_SET) != 0) {
+        throw std::runtime_error("Pool snapshot is truncated");
+      }
+      tables.addresses.resize(header.numBlocks);
+      tables.chunks.resize(header.numChunks);
+      tables.relocs.resize(header.numRelocs);
+      tables.roots.resize(header.numRoots);
+      tables.types.resize(header.numTypeWords);
+      tables.sites.resize(header.numSiteWords);
+      for (std::vector<uint64_t>* table : {&tables.addresses, &tables.chunks, &tables.relocs, &tables.roots, &tables.types,
+                                           &tables.sites}) {
+        if (!table->empty() && std::fread(table->data(), 8, table->size(), file) != table->size()) {
+          throw std::runtime_error("Pool snapshot is truncated");
+        }
+      }
+      // load looks addresses up by binary search
+      auto aligned = [](const std::vector<uint64_t>& table, size_t align) {
+        for (size_t i = 0; i < table.size(); i++) {
+          if (table[i] % align != 0 || (i > 0 && table[i] <= table[i - 1])) {
+            return false;
+          }
+        }
+        return true;
+      };
+      if (!aligned(tables.addresses, blockSize) || !aligned(tables.chunks, chunkSize) ||
+          !std::is_sorted(tables.relocs.begin(), tables.relocs.end())) {
+        throw std::runtime_error("Pool snapshot tables are corrupt");
+      }
+      return tables;
+    }
+
+    // Rebuilds the chunk lists from the chunk metadata of every block, after
+    // the blocks were loaded. Must be called with the mutex held
+    void rebuild() {
+      this->curChunk = nullptr;
+      this->freeChunk = nullptr;
+      this->emptyBlocks = nullptr;
+      std::fill(std::begin(this->bins), std::end(this->bins), nullptr);
+      this->binMask = 0;
+      #ifdef MEMPOOL_GC
+        this->sweepQueue.clear();
+        this->sweepPos = 0;
+      #endif
+      std::vector<Block*> sorted;
+      for (const auto& it : this->blocks) {
+        sorted.push_back(it.second);
+      }
+      std::sort(sorted.begin(), sorted.end(), std::greater<Block*>());
+      for (Block* block : sorted) {
+        block->pool = this;
+        for (uint64_t& mask : block->emptyMask) {
+          mask = 0;
+        }
+        for (auto& mask : block->dirtyMask) {
+          mask.store(0, std::memory_order_relaxed);
+        }
+        for (size_t i = chunksPerBlock; i-- > headerChunks;) {
+          Chunk* chunk = &block->chunks[i];
+          chunk->next = nullptr;
+          chunk->prev = nullptr;
+          #ifdef MEMPOOL_GC
+            chunk->sweepEnd = 0;
+          #endif
+          if (chunk->empty()) {
+            chunk->head = 0;
+            this->pushEmpty(chunk);
+          } else if (this->policy == ChunkPolicy::BestFit) {
+            this->bin(chunk);
+          }
+        }
+      }
+      this->nextChunk(0, 1);
+    }
+
+    #ifdef MEMPOOL_TYPE_TAGS
+      // Calls f(void* obj, size_t size, uint16_t tag) for every live and
+      // constructed allocation, walking chunks from header to header in
+      // address order. Must be called with the mutex held
+      template <class F>
+      void walk(F&& f) {
+        this->drainRemote();
+        std::vector<Block*> sorted;
+        for (const auto& it : this->blocks) {
+          sorted.push_back(it.second);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        for (Block* block : sorted) {
+          for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+            const Chunk& chunk = block->chunks[i];
+            if (chunk.empty()) {
+              continue;
+            }
+            char* data = chunk.data();
+            for (size_t pos = 0; pos < chunk.head;) {
+              TagHeader* header = (TagHeader*)(data + pos);
+              const uint16_t tag = loadTag(header);
+              if (tag != freeTag && tag != paddingTag && tag != constructingTag) {
+                f((void*)(header + 1), header->size - sizeof(TagHeader), tag);
+              }
+              pos += header->size;
+            }
+          }
+        }
+      }
+    #endif
+
+    #ifdef MEMPOOL_GC
+      // Sets the mark bit of the allocation at ptr, returning false if it was
+      // already set
+      static bool setMark(const void* ptr) {
+        Block* block = blockOf(ptr);
+        const size_t offset = (uintptr_t)ptr & (blockSize - 1);
+        const size_t g = (offset % chunkSize) / sizeof(TagHeader);
+        uint64_t& word = block->markBits[offset / chunkSize][g / 64];
+        const uint64_t bit = (uint64_t)1 << (g % 64);
+        if (word & bit) {
+          return false;
+        }
+        word |= bit;
+        return true;
+      }
+
+      static bool isMarked(const void* ptr) {
+        const Block* block = blockOf(ptr);
+        const size_t offset = (uintptr_t)ptr & (blockSize - 1);
+        const size_t g = (offset % chunkSize) / sizeof(TagHeader);
+        return block->markBits[offset / chunkSize][g / 64] & ((uint64_t)1 << (g % 64));
+      }
+
+      // Marks everything reachable from the roots and queues every occupied
+      // chunk for sweeping. Must be called with the mutex held
+      void markReachable() {
+        this->sweepChunks(SIZE_MAX);
+        this->drainRemote();
+        for (const auto& it : this->blocks) {
+          std::memset(it.second->markBits, 0, sizeof(it.second->markBits));
+        }
+        std::vector<void*> gray;
+        auto reach = [&](void* ptr) {
+          if (ptr != nullptr && this->contains(ptr) && setMark(ptr)) {
+            gray.push_back(ptr);
+          }
+        };
+        for (void** root : this->roots) {
+          reach(*root);
+        }
+        Relocations fields;
+        while (!gray.empty()) {
+          void* obj = gray.back();
+          gray.pop_back();
+          const TypeInfo* type = typeInfoOf(loadTag((TagHeader*)obj - 1));
+          if (type == nullptr || type->trace == nullptr) {
+            continue;
+          }
+          fields.fields.clear();
+          type->trace(obj, fields);
+          for (uintptr_t field : fields.fields) {
+            void* ptr;
+            std::memcpy(&ptr, (void*)field, sizeof(void*));
+            reach(ptr);
+          }
+        }
+        this->sweepQueue.clear();
+        this->sweepPos = 0;
+        for (const auto& it : this->blocks) {
+          for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+            Chunk* chunk = &it.second->chunks[i];
+            if (!chunk->empty()) {
+              // Allocations after the mark land at or beyond head
+              chunk->sweepEnd = chunk->head;
+              this->sweepQueue.push_back(chunk);
+            }
+          }
+        }
+      }
+
+      // Frees the unmarked allocations of up to maxChunks queued chunks,
+      // returning how many were freed. Must be called with the mutex held
+      size_t sweepChunks(size_t maxChunks) {
+        this->drainRemote();
+        size_t freed = 0;
+        for (; maxChunks > 0 && this->sweepPos < this->sweepQueue.size(); maxChunks--) {
+          Chunk* chunk = this->sweepQueue[this->sweepPos++];
+          char* data = chunk->data();
+          // Releasing the last allocation resets sweepEnd, ending the walk
+          for (size_t pos = 0; pos < chunk->sweepEnd;) {
+            TagHeader* header = (TagHeader*)(data + pos);
+            pos += header->size;
+            const uint16_t tag = loadTag(header);
+            if (tag == freeTag || tag == paddingTag || tag == constructingTag || isMarked(header + 1)) {
+              continue;
+            }
+            const TypeInfo* type = typeInfoOf(tag);
+            if (type != nullptr) {
+              type->destroy(header + 1);
+            }
+            this->release(chunk, untag(header + 1, 0));
+            freed++;
+          }
+          chunk->sweepEnd = 0;
+        }
+        if (this->sweepPos == this->sweepQueue.size()) {
+          this->sweepQueue.clear();
+          this->sweepPos = 0;
+        }
+        return freed;
+      }
+    #endif
+
+    // Reserves size zeroed bytes with given alignment for an object with
+    // given type tag, only clearing what is below the chunk's dirty mark
+    void* allocZeroed(size_t size, size_t align, uint16_t tag) {
+      size = nonZero(size);
+      char* ptr;
+      size_t clear;
+      {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        if (!this->curChunk->fits(size, align)) {
+          this->nextChunk(size, align);
+        }
+        const size_t dirty = this->curChunk->dirty;
+        ptr = (char*)this->curChunk->alloc(size, align, tag);
+        const size_t offset = ptr - this->curChunk->data();
+        clear = dirty > offset ? (dirty < offset + size ? dirty : offset + size) - offset : 0;
+      }
+      // The memory is reserved, so it can be cleared without holding the lock
+      if (clear > 0) {
+        detail::clearMemory(ptr, clear);
+      }
+      return ptr;
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct a new memory pool
+     * 
+     * @param policy How to pick the next chunk once the current one is full
+     */
+    explicit MemPool(ChunkPolicy policy = ChunkPolicy::Lifo) : policy(policy) { nextChunk(0, 1); }
+
+    ~MemPool() {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      for (auto it : blocks) {
+        detail::unmapBlock(it.second, blockSize);
+      }
+      #ifdef MEMPOOL_MEMFD
+        if (this->backing) {
+          this->detachBacking();
+        }
+      #endif
+      this->curChunk = nullptr;
+      this->freeChunk = nullptr;
+      this->emptyBlocks = nullptr;
+    }
+
+    /**
+     * @brief Allocates object in memory pool, returns shared_ptr to object.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return std::shared_ptr<T> The allocated object
+     */
+    template <class T, class... V>
+    std::shared_ptr<T> makeShared(V&&... v) {
+      static_assert(allocSize<T>() <= capacity(allocAlign<T>()), "Object is too large for chunk");
+      T* obj = this->emplace<T>(allocSize<T>(), allocAlign<T>(), std::forward<V>(v)...);
+      Chunk* chunk = chunkOf(obj);
+      return std::shared_ptr<T>(obj, [this, chunk](T* o) { this->destructHandler<T>(chunk, o, allocSize<T>()); });
+    }
+
+    /**
+     * @brief Allocates object in memory pool, returns pointer to object
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object
+     */
+    template <class T, class... V>
+    T* make(V&&... v) {
+      static_assert(allocSize<T>() <= capacity(allocAlign<T>()), "Object is too large for chunk");
+      return this->emplace<T>(allocSize<T>(), allocAlign<T>(), std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Allocates object followed by extra bytes of trailing storage in
+     * memory pool, returns pointer to object. Use for a header with a variable
+     * length payload, which then takes one allocation and sits in one place.
+     * The payload is found with benpm::trailing(obj).
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param extra Number of bytes of trailing storage
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object, must be freed with freeWithTrailing
+     * @throws std::bad_alloc If object and trailing storage exceed chunkSize
+     */
+    template <class T, class... V>
+    T* makeWithTrailing(size_t extra, V&&... v) {
+      const size_t size = trailingSize<T>(extra);
+      return this->emplace<T>(size, allocAlign<T>(), std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Allocates object followed by extra bytes of trailing storage in
+     * memory pool, returns shared_ptr to object. See makeWithTrailing.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param extra Number of bytes of trailing storage
+     * @param v The arguments to pass to the constructor of T
+     * @return std::shared_ptr<T> The allocated object
+     * @throws std::bad_alloc If object and trailing storage exceed chunkSize
+     */
+    template <class T, class... V>
+    std::shared_ptr<T> makeSharedWithTrailing(size_t extra, V&&... v) {
+      const size_t size = trailingSize<T>(extra);
+      T* obj = this->emplace<T>(size, allocAlign<T>(), std::forward<V>(v)...);
+      Chunk* chunk = chunkOf(obj);
+      return std::shared_ptr<T>(obj, [this, chunk, size](T* o) { this->destructHandler<T>(chunk, o, size); });
+    }
+
+    /**
+     * @brief Allocates object in memory pool on cache lines of its own,
+     * returns pointer to object. Use for objects written by different threads,
+     * such as per-thread counters, to prevent false sharing. Types that always
+     * need this can specialize CacheIsolated instead.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object, must be freed with freeIsolated
+     */
+    template <class T, class... V>
+    T* makeIsolated(V&&... v) {
+      static_assert(isolatedSize<T>() <= capacity(isolatedAlign<T>()), "Object is too large for chunk");
+      return this->emplace<T>(isolatedSize<T>(), isolatedAlign<T>(), std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Allocates uninitialized memory in memory pool
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @param size Number of bytes to allocate, at most getMaxAllocSize(align).
+     * Zero-size requests reserve one byte and get a distinct pointer
+     * @param align Alignment of the memory, a power of 2
+     * @return void* The allocated memory
+     * @throws std::bad_alloc If size exceeds getMaxAllocSize(align) or align
+     * exceeds chunkSize
+     */
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+      if (align > chunkSize || size > capacity(align)) {
+        throw std::bad_alloc();
+      }
+      size = nonZero(size);
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      if (!this->curChunk->fits(size, align)) {
+        this->nextChunk(size, align);
+      }
+      return this->curChunk->alloc(size, align, untypedTag);
+    }
+
+    /**
+     * @brief Allocates zero-initialized object in memory pool, returns pointer
+     * to object. Memory untouched since its block was mapped is known to be
+     * zero and is not cleared again; recycled memory is cleared with
+     * non-temporal stores for large objects.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The object type to allocate, must be trivial
+     * @return T* The allocated object
+     */
+    template <class T>
+    T* makeZeroed() {
+      static_assert(std::is_trivial<T>::value, "Zeroed allocation requires a trivial type");
+      static_assert(allocSize<T>() <= capacity(allocAlign<T>()), "Object is too large for chunk");
+      return (T*)this->allocZeroed(allocSize<T>(), allocAlign<T>(), tagOf<T>());
+    }
+
+    /**
+     * @brief Allocates zero-initialized array in memory pool, returns pointer
+     * to its first element. See makeZeroed.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @tparam T The element type, must be trivial
+     * @param n Number of elements, at most getMaxAllocSize(alignof(T)) / sizeof(T)
+     * @return T* The allocated array, must be freed with freeN
+     * @throws std::bad_alloc If the array is larger than chunkSize
+     */
+    template <class T>
+    T* makeZeroedN(size_t n) {
+      static_assert(std::is_trivial<T>::value, "Zeroed allocation requires a trivial type");
+      if (n > capacity(alignof(T)) / sizeof(T)) {
+        throw std::bad_alloc();
+      }
+      // Arrays are untyped, as visit could not tell their length
+      return (T*)this->allocZeroed(n * sizeof(T), alignof(T), untypedTag);
+    }
+
+    /**
+     * @brief Frees array allocated with makeZeroedN from memory pool
+     * 
+     * @tparam T The element type
+     * @param ptr Pointer to the first element
+     * @param n Number of elements
+     */
+    template <class T>
+    void freeN(T* ptr, size_t n) {
+      static_assert(std::is_trivially_destructible<T>::value, "Arrays are not destructed");
+      this->deallocate(ptr, n * sizeof(T));
+    }
+
+    /**
+     * @brief Frees memory returned by allocate
+     * 
+     * @param ptr Pointer to memory that was allocated in this pool
+     * @param size Number of bytes that were allocated
+     */
+    void deallocate(void* ptr, size_t size) {
+      // assert(this->contains(ptr));
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      this->release(chunkOf(ptr), untag(ptr, size));
+    }
+
+    /**
+     * @brief Frees many ranges returned by allocate under a single lock
+     * acquisition
+     * 
+     * @tparam It Iterator over std::pair<void*, size_t> of pointer and size
+     * @param begin First range
+     * @param end Past the last range
+     */
+    template <class It>
+    void deallocateBatch(It begin, It end) {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      for (It it = begin; it != end; ++it) {
+        this->release(chunkOf(it->first), untag(it->first, it->second));
+      }
+    }
+
+    /**
+     * @brief Frees object from memory pool
+     * 
+     * @tparam T Object type
+     * @param obj Pointer to object that was alloc'd in this pool
+     */
+    template <class T>
+    void free(T* obj) {
+      // assert(this->contains(obj));
+      this->destructHandler<T>(chunkOf(obj), obj, allocSize<T>());
+    }
+
+    /**
+     * @brief Frees object from memory pool from a thread that does not own
+     * it. The object is destructed right away, but its memory is only pushed
+     * onto a lock-free stack, which the owning thread reclaims the next time
+     * it needs a new chunk. Lets a pool used without MEMPOOL_THREADSAFE by one
+     * thread take frees from others.
+     * 
+     * @note This function is thread-safe and lock-free.
+     * 
+     * @tparam T Object type, at least a pointer and 4 bytes large
+     * @param obj Pointer to object that was alloc'd in this pool
+     */
+    template <class T>
+    void freeRemote(T* obj) {
+      static_assert(allocSize<T>() >= remoteMinSize, "Object is too small to be freed remotely");
+      obj->~T();
+      this->pushRemote(obj, allocSize<T>());
+    }
+
+    /**
+     * @brief Frees memory returned by allocate from a thread that does not own
+     * the pool. See freeRemote.
+     * 
+     * @note This function is thread-safe and lock-free.
+     * 
+     * @param ptr Pointer to memory that was allocated in this pool
+     * @param size Number of bytes that were allocated, at least a pointer and
+     * 4 bytes
+     * @throws std::invalid_argument If size is too small to link the memory
+     * into the remote free stack. Nothing is written then
+     */
+    void deallocateRemote(void* ptr, size_t size) {
+      if (size < remoteMinSize) {
+        throw std::invalid_argument("Memory is too small to be freed remotely");
       }
-    };
+      this->pushRemote(ptr, size);
+    }
 
-    // Non-full chunk which is currently being used
-    Chunk* curChunk = nullptr;
-    // Map from block index to block pointer
-    std::unordered_map<size_t, Chunk*> blocks;
-    // Mutex for thread safety
-    mutable std::mutex mutex;
+    /**
+     * @brief Frees object allocated with makeWithTrailing from memory pool
+     * 
+     * @tparam T Object type
+     * @param obj Pointer to object that was alloc'd in this pool
+     * @param extra Number of bytes of trailing storage it was allocated with
+     */
+    template <class T>
+    void freeWithTrailing(T* obj, size_t extra) {
+      // assert(this->contains(obj));
+      this->destructHandler<T>(chunkOf(obj), obj, trailingSize<T>(extra));
+    }
 
-    // Bound, called for a particular chunk and object when shared_ptr ref count
-    // hits 0
+    /**
+     * @brief Frees object allocated with makeIsolated from memory pool
+     * 
+     * @tparam T Object type
+     * @param obj Pointer to object that was alloc'd in this pool
+     */
     template <class T>
-    void destructHandler(Chunk* chunk, T* obj) {
+    void freeIsolated(T* obj) {
       // assert(this->contains(obj));
-      // assert(this->inChunk(obj, chunk));
+      this->destructHandler<T>(chunkOf(obj), obj, isolatedSize<T>());
+    }
+
+    /**
+     * @brief Writes every block to a file, with a table of the pointer fields
+     * to relocate and a list of root pointers, for load to restore later,
+     * possibly in another process. Starts a new checkpoint for
+     * saveIncremental.
+     * 
+     * Objects are saved byte for byte, so they must not hold pointers outside
+     * the pool, vtables or other process specific state, and every pointer
+     * into the pool must be in relocations. Type tags and allocation sites
+     * are saved with their names, as their numbers differ between processes.
+     * 
+     * @note This function is thread-safe, but objects must not be modified
+     * while it runs.
+     * 
+     * @param path File to write
+     * @param relocations Pointer fields of the live objects
+     * @param roots Pointers into the pool to hand back from load
+     * @throws std::system_error If the file cannot be written
+     */
+    void save(const char* path, const Relocations& relocations, const std::vector<void*>& roots = {}) {
       #ifdef MEMPOOL_THREADSAFE
-        std::lock_guard<std::mutex> lock(this->mutex);
+        std::lock_guard<std::mutex> lock(mutex);
       #endif
-      chunk->used -= sizeof(T);
-      obj->~T();
-      if (chunk->empty()) {
-        chunk->head = ((char*)chunk) + sizeof(Chunk);
-        #ifdef MEMPOOL_EMPTY_INSERT_AFTER
-          // Insert self after current chunk in linked list
-          chunk->next = this->curChunk->next;
-          this->curChunk->next = chunk;
+      this->writeSnapshot(path, false, relocations, roots);
+    }
+
+    /**
+     * @brief Writes only the chunks changed since the last save or
+     * saveIncremental, so the cost follows the amount of change rather than
+     * the size of the pool. load restores a full snapshot followed by its
+     * increments in order.
+     * 
+     * Chunks that are allocated from or freed to are tracked automatically.
+     * Objects modified in place must be reported with touch, or their changes
+     * are missing from the increment. relocations may list every pointer
+     * field, only those in changed chunks are kept.
+     * 
+     * @note This function is thread-safe, but objects must not be modified
+     * while it runs.
+     * 
+     * @param path File to write
+     * @param relocations Pointer fields of the live objects
+     * @param roots Pointers into the pool to hand back from load
+     * @throws std::logic_error If no full snapshot was saved since the pool
+     * was created or loaded
+     * @throws std::system_error If the file cannot be written
+     */
+    void saveIncremental(const char* path, const Relocations& relocations, const std::vector<void*>& roots = {}) {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      if (!this->checkpointed) {
+        throw std::logic_error("An incremental snapshot needs a full one first");
+      }
+      this->writeSnapshot(path, true, relocations, roots);
+    }
+
+    /**
+     * @brief Marks the chunk holding an object as changed, for the next
+     * saveIncremental. Call after modifying an object in place.
+     * 
+     * @note This function is thread-safe and lock-free.
+     * 
+     * @param ptr Pointer to memory allocated in this pool
+     */
+    void touch(const void* ptr) {
+      // assert(this->contains(ptr));
+      markDirty(chunkOf(ptr));
+    }
+
+    /**
+     * @brief Replaces the pool's contents with a snapshot written by save
+     * from a pool with the same chunkSize and chunksPerBlock. Blocks are
+     * mapped copy-on-write from the file where possible, then every
+     * relocated pointer is patched in one pass over the sorted relocation
+     * table.
+     * 
+     * All objects currently in the pool are discarded without being
+     * destructed. Snapshots are disabled again.
+     * 
+     * The file must have been saved with the same MEMPOOL_TYPE_TAGS,
+     * MEMPOOL_ALLOC_SITES and MEMPOOL_GC settings. With type tags, saved
+     * tags are mapped to this process's by type name, so every type with
+     * objects in the file must be registered first, by allocating it or
+     * calling typeInfoOf<T>(). Unknown allocation sites become noSite.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @param path File written by save
+     * @return std::vector<void*> The roots passed to save, relocated
+     * @throws std::system_error If the file cannot be read
+     * @throws std::runtime_error If the file is not a snapshot of a pool of
+     * this geometry, or names memory outside its chunks. The pool is left
+     * as it was
+     */
+    std::vector<void*> load(const char* path) {
+      return this->load(std::vector<std::string>{path});
+    }
+
+    /**
+     * @brief Replaces the pool's contents with a full snapshot written by
+     * save, followed by increments written by saveIncremental, in the order
+     * they were saved. Every increment's chunks are copied over the blocks,
+     * then pointers are patched once, in one pass over the merged relocation
+     * table.
+     * 
+     * @note This function is thread-safe.
+     * 
+     * @param paths Full snapshot, then its increments
+     * @return std::vector<void*> The roots passed with the last file,
+     * relocated
+     * @throws std::system_error If a file cannot be read
+     * @throws std::runtime_error If the files are not a chain of snapshots
+     * of a pool of this geometry, or name memory outside their chunks. The
+     * pool is left as it was
+     */
+    std::vector<void*> load(const std::vector<std::string>& paths) {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      if (paths.empty()) {
+        throw std::invalid_argument("No snapshot to load");
+      }
+      // Map the new blocks before dropping the old ones, so failure leaves
+      // the pool as it was
+      std::vector<uint64_t> addresses;
+      std::vector<Block*> mapped;
+      std::vector<uint64_t> relocs;
+      std::vector<uint64_t> roots;
+      // Name tables of the last file, as they only grow
+      std::vector<uint64_t> types;
+      std::vector<uint64_t> sites;
+      std::vector<void*> result;
+      try {
+        for (size_t f = 0; f < paths.size(); f++) {
+          const char* path = paths[f].c_str();
+          std::FILE* file = std::fopen(path, "rb");
+          if (file == nullptr) {
+            throw std::system_error(errno, std::generic_category(), path);
+          }
+          std::unique_ptr<std::FILE, int (*)(std::FILE*)> closer(file, &std::fclose);
+          SnapshotTables tables = readSnapshot(file, f > 0);
+          if (f == 0) {
+            for (size_t i = 0; i < tables.addresses.size(); i++) {
+              mapped.push_back((Block*)detail::mapFileBlock(file, tables.header.dataOffset + i * blockSize, blockSize));
+            }
+            addresses = std::move(tables.addresses);
+            relocs = std::move(tables.relocs);
+            roots = std::move(tables.roots);
+            types = std::move(tables.types);
+            sites = std::move(tables.sites);
+            continue;
+          }
+          // Blocks are never released, so an increment lists every block of
+          // the snapshots before it, and possibly new ones
+          if (!std::includes(tables.addresses.begin(), tables.addresses.end(), addresses.begin(), addresses.end())) {
+            throw std::runtime_error("Incremental pool snapshot does not follow the previous one");
+          }
+          std::vector<Block*> next;
+          mapped.reserve(tables.addresses.size());
+          for (size_t i = 0, j = 0; i < tables.addresses.size(); i++) {
+            if (j < addresses.size() && addresses[j] == tables.addresses[i]) {
+              next.push_back(mapped[j++]);
+            } else {
+              // Owned by mapped until the swap, in case of failure
+              mapped.push_back((Block*)detail::mapBlock(blockSize));
+              next.push_back(mapped.back());
+            }
+          }
+          mapped.swap(next);
+          addresses = std::move(tables.addresses);
+          for (size_t i = 0; i < tables.chunks.size(); i++) {
+            const uint64_t base = tables.chunks[i] & ~(uint64_t)(blockSize - 1);
+            auto it = std::lower_bound(addresses.begin(), addresses.end(), base);
+            if (it == addresses.end() || *it != base) {
+              throw std::runtime_error("Incremental pool snapshot is corrupt");
+            }
+            char* chunk = (char*)mapped[it - addresses.begin()] + (tables.chunks[i] - base);
+            if (std::fseek(file, (long)(tables.header.dataOffset + i * chunkSize), SEEK_SET) != 0 ||
+                std::fread(chunk, 1, chunkSize, file) != chunkSize) {
+              throw std::runtime_error("Pool snapshot is truncated");
+            }
+          }
+          // Fields in rewritten chunks are replaced by the increment's
+          std::vector<uint64_t> kept;
+          for (uint64_t field : relocs) {
+            if (!std::binary_search(tables.chunks.begin(), tables.chunks.end(), field & ~(uint64_t)(chunkSize - 1))) {
+              kept.push_back(field);
+            }
+          }
+          relocs.clear();
+          std::merge(kept.begin(), kept.end(), tables.relocs.begin(), tables.relocs.end(), std::back_inserter(relocs));
+          roots = std::move(tables.roots);
+          types = std::move(tables.types);
+          sites = std::move(tables.sites);
+        }
+        // Check everything the files name against the mapped blocks before
+        // writing through it, so a corrupt or mismatched snapshot fails here
+        // and leaves the pool as it was
+        for (Block* block : mapped) {
+          for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+            const Chunk& chunk = block->chunks[i];
+            if (chunk.head > chunkSize || chunk.used > chunk.head || chunk.dirty > chunkSize) {
+              throw std::runtime_error("Pool snapshot has corrupt chunk metadata");
+            }
+          }
+        }
+        #ifdef MEMPOOL_TYPE_TAGS
+          this->remapTags(mapped, types, sites);
         #else
-          // Insert self before current chunk in linked list, then make myself
-          // current
-          chunk->next = this->curChunk;
-          this->curChunk = chunk;
+          (void)types;
+          (void)sites;
         #endif
+        // Old address to new address, or null if it is not in an occupied
+        // part of a saved chunk. Addresses are sorted, so the block of an
+        // old address is found by binary search
+        auto locate = [&](uint64_t old, size_t size) -> char* {
+          const uint64_t base = old & ~(uint64_t)(blockSize - 1);
+          auto it = std::lower_bound(addresses.begin(), addresses.end(), base);
+          if (it == addresses.end() || *it != base) {
+            return nullptr;
+          }
+          Block* block = mapped[it - addresses.begin()];
+          const size_t offset = old - base;
+          if (offset / chunkSize < headerChunks || offset % chunkSize + size > block->chunks[offset / chunkSize].head) {
+            return nullptr;
+          }
+          return (char*)block + offset;
+        };
+        for (uint64_t root : roots) {
+          char* ptr = root == 0 ? nullptr : locate(root, 1);
+          if (root != 0 && ptr == nullptr) {
+            throw std::runtime_error("Pool snapshot root is outside its chunks");
+          }
+          result.push_back(ptr);
+        }
+        std::vector<char*> fields;
+        fields.reserve(relocs.size());
+        for (uint64_t field : relocs) {
+          fields.push_back(locate(field, sizeof(uint64_t)));
+          if (fields.back() == nullptr) {
+            throw std::runtime_error("Pool snapshot relocates a field outside its chunks");
+          }
+        }
+        // Values outside the saved blocks are left unchanged, as documented
+        // for Relocations::add
+        for (char* field : fields) {
+          uint64_t value;
+          std::memcpy(&value, field, sizeof(value));
+          const uint64_t base = value & ~(uint64_t)(blockSize - 1);
+          auto it = std::lower_bound(addresses.begin(), addresses.end(), base);
+          if (it != addresses.end() && *it == base) {
+            value = (uint64_t)(uintptr_t)mapped[it - addresses.begin()] + (value - base);
+            std::memcpy(field, &value, sizeof(value));
+          }
+        }
+      } catch (...) {
+        for (Block* block : mapped) {
+          detail::unmapBlock(block, blockSize);
+        }
+        throw;
+      }
+      for (auto it : this->blocks) {
+        detail::unmapBlock(it.second, blockSize);
+      }
+      this->blocks.clear();
+      this->remoteFrees.store(nullptr, std::memory_order_relaxed);
+      #ifdef MEMPOOL_MEMFD
+        if (this->backing) {
+          this->detachBacking();
+        }
+        this->copyOnWrite = false;
+      #endif
+      for (Block* block : mapped) {
+        this->blocks.emplace(getBlockIdx(block), block);
       }
+      this->checkpointed = false;
+      this->rebuild();
+      return result;
     }
 
-    // Allocates a new block of chunks
-    void allocBlock() {
-      Chunk* block = (Chunk*)(aligned_alloc(blockSize, blockSize));
-      // assert((size_t)(char*)block % blockSize == 0);
-      Chunk* c = block;
-      for (size_t i = 0; i < chunksPerBlock - 1; c = c->next, i++) {
-        c->init((Chunk*)((char*)(c) + chunkSize));
+    /**
+     * @brief Copies the whole pool into a new one, block by block, instead of
+     * copying objects one at a time. Only the occupied part of each chunk is
+     * copied, and pointer fields listed in relocations are moved by the
+     * distance between the old and new block, so object graphs come out
+     * intact.
+     * 
+     * As with save, objects are copied byte for byte and must otherwise be
+     * trivially relocatable. The copy has its own blocks and does not take
+     * snapshots or checkpoints until asked to.
+     * 
+     * @note This function is thread-safe, but objects must not be modified
+     * while it runs.
+     * 
+     * @param relocations Pointer fields of the live objects
+     * @param roots Pointers into this pool, replaced with the same objects
+     * in the copy
+     * @return std::unique_ptr<MemPool> The copy
+     */
+    std::unique_ptr<MemPool> clone(const Relocations& relocations, std::vector<void*>& roots) {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      this->drainRemote();
+      auto copy = std::make_unique<MemPool>(this->policy);
+      for (auto it : copy->blocks) {
+        detail::unmapBlock(it.second, blockSize);
       }
-      c->init(nullptr);
-      if (this->curChunk != nullptr) {
-        this->curChunk->next = block;
+      copy->blocks.clear();
+      copy->curChunk = nullptr;
+      copy->freeChunk = nullptr;
+      copy->emptyBlocks = nullptr;
+      copy->growable = this->growable;
+      // Copy of each block, by block index
+      std::unordered_map<size_t, Block*> copies;
+      for (const auto& it : this->blocks) {
+        const Block* src = it.second;
+        Block* dst = (Block*)detail::mapBlock(blockSize);
+        copy->blocks.emplace(getBlockIdx(dst), dst);
+        copies.emplace(it.first, dst);
+        size_t end = sizeof(Block);
+        for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+          if (!src->chunks[i].empty()) {
+            end = i * chunkSize + src->chunks[i].head;
+          }
+        }
+        detail::prefault(dst, end);
+        std::memcpy((void*)dst, (const void*)src, sizeof(Block));
+        for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+          Chunk& chunk = dst->chunks[i];
+          if (!chunk.empty()) {
+            std::memcpy(chunk.data(), src->chunks[i].data(), chunk.head);
+          }
+          // Past what was copied, the fresh block is still zero
+          chunk.dirty = chunk.empty() ? 0 : chunk.head;
+        }
       }
-      this->curChunk = block;
-      // assert(blocks.count(getBlockIdx(block)) == 0);
-      blocks.emplace(getBlockIdx(block), block);
-    }
 
-    // Returns the block index of a memory address
-    size_t getBlockIdx(void* ptr) const {
-      return (size_t)(char*)ptr / blockSize;
-    }
+      // Moves an address into the copy. Neighbouring fields and their
+      // targets tend to share blocks, so the last block found is tried first
+      struct Rebase {
+        const std::unordered_map<size_t, Block*>& copies;
+        size_t idx = SIZE_MAX;
+        uintptr_t delta = 0;
 
-    // Returns true if given memory address resides in this pool
-    bool contains(void* ptr) const {
-      return this->blocks.count(this->getBlockIdx(ptr));
+        uintptr_t operator()(uintptr_t ptr) {
+          if (ptr / blockSize != this->idx) {
+            auto it = this->copies.find(ptr / blockSize);
+            if (it == this->copies.end()) {
+              return ptr;
+            }
+            this->idx = it->first;
+            this->delta = (uintptr_t)it->second - it->first * blockSize;
+          }
+          return ptr + this->delta;
+        }
+      };
+      Rebase rebaseField{copies};
+      Rebase rebaseValue{copies};
+      for (uintptr_t field : relocations.fields) {
+        void* location = (void*)rebaseField(field);
+        uintptr_t value;
+        std::memcpy(&value, location, sizeof(value));
+        value = rebaseValue(value);
+        std::memcpy(location, &value, sizeof(value));
+      }
+      for (void*& root : roots) {
+        root = (void*)rebaseValue((uintptr_t)root);
+      }
+      copy->rebuild();
+      return copy;
     }
 
-    // Returns true if given memory address resides in given chunk
-    bool inChunk(void* ptr, Chunk* chunk) const {
-      return (char*)ptr >= (char*)chunk &&
-            (char*)ptr < (char*)chunk + chunkSize;
-    }
+    #ifdef MEMPOOL_MEMFD
+      /**
+       * @brief Read-only, point-in-time view of a pool's blocks, taken with
+       * MemPool::snapshot. Objects are reached by translating pool addresses
+       * with get, including pointers read from other objects in the view.
+       * The view stays valid and unchanged after the pool is modified or
+       * destroyed, until the snapshot itself is destroyed. May be used and
+       * destroyed on any thread.
+       */
+      class Snapshot {
+      private:  // ----------------------------------------------------------
+        friend class MemPool;
+        std::shared_ptr<detail::BackingFile> backing;
+        // Offset of each block in the view, by block index
+        std::unordered_map<size_t, uint64_t> offsets;
+        const char* view = nullptr;
+        size_t length = 0;
 
-  public:  // ------------------------------------------------------------
-    MemPool() { allocBlock(); }
+        Snapshot(std::shared_ptr<detail::BackingFile> backing, std::unordered_map<size_t, uint64_t> offsets)
+            : backing(std::move(backing)), offsets(std::move(offsets)), length(this->backing->size()) {
+          if (this->length > 0) {
+            void* view = mmap(nullptr, this->length, PROT_READ, MAP_SHARED, this->backing->fd, 0);
+            if (view == MAP_FAILED) {
+              throw std::system_error(errno, std::generic_category(), "mmap");
+            }
+            this->view = (const char*)view;
+          }
+          for (const auto& it : this->offsets) {
+            this->backing->retain(it.second);
+          }
+        }
 
-    ~MemPool() {
+      public:  // ----------------------------------------------------------
+        Snapshot(Snapshot&& other) noexcept
+            : backing(std::move(other.backing)), offsets(std::move(other.offsets)),
+              view(other.view), length(other.length) {
+          other.view = nullptr;
+          other.length = 0;
+        }
+
+        Snapshot& operator=(Snapshot&& other) noexcept {
+          std::swap(this->backing, other.backing);
+          std::swap(this->offsets, other.offsets);
+          std::swap(this->view, other.view);
+          std::swap(this->length, other.length);
+          return *this;
+        }
+
+        ~Snapshot() {
+          if (this->view != nullptr) {
+            munmap((void*)this->view, this->length);
+          }
+          if (this->backing) {
+            for (const auto& it : this->offsets) {
+              this->backing->release(it.second);
+            }
+          }
+        }
+
+        /**
+         * @brief Translates an address in the pool to the same object in
+         * this view
+         * 
+         * @tparam T Object type
+         * @param ptr Pointer into the pool, or null
+         * @return const T* The object as of the snapshot, or null
+         * @throws std::out_of_range If ptr is not in a block that existed
+         * when the snapshot was taken
+         */
+        template <class T>
+        const T* get(const T* ptr) const {
+          if (ptr == nullptr) {
+            return nullptr;
+          }
+          const uint64_t offset = this->offsets.at((size_t)(uintptr_t)ptr / blockSize);
+          return (const T*)(this->view + offset + ((uintptr_t)ptr & (blockSize - 1)));
+        }
+
+        /**
+         * @brief Returns the number of bytes in the view
+         * 
+         * @return size_t
+         */
+        size_t size() const {
+          return this->length;
+        }
+      };
+
+      /**
+       * @brief Moves the pool's blocks into a memory file, so that snapshot
+       * can be used. Blocks stay at the same addresses. Linux only.
+       * 
+       * @note This function is thread-safe, but objects must not be modified
+       * while it runs.
+       * 
+       * @throws std::system_error If the memory file cannot be created
+       */
+      void enableSnapshots() {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        static_assert(blockSize % 4096 == 0, "Snapshots need blocks of whole pages");
+        if (this->backing) {
+          return;
+        }
+        this->backing = std::make_shared<detail::BackingFile>(blockSize);
+        try {
+          for (const auto& it : this->blocks) {
+            this->attachBlock(it.second, true);
+          }
+        } catch (...) {
+          // Blocks attached so far hold the same contents, shared, so the
+          // file is closed without emptying their regions
+          this->blockOffsets.clear();
+          this->backing.reset();
+          throw;
+        }
+      }
+
+      /**
+       * @brief Takes a consistent read-only view of every block, for readers
+       * such as exporters to use while the pool keeps being modified.
+       * 
+       * No memory is copied: the blocks are remapped copy-on-write over the
+       * memory file, which the snapshot maps read-only, so a page is only
+       * copied once the pool's users write to it. When the next snapshot is
+       * taken, the pages copied since are written back to the file, or if an
+       * older snapshot still reads a written block, that whole block is
+       * written to a new part of the file. Blocks nobody wrote are shared by
+       * all the snapshots, so taking one costs a copy of the blocks written
+       * since the last, not of the whole pool.
+       * 
+       * @note This function is thread-safe, but objects must not be modified
+       * while it runs.
+       * 
+       * @return Snapshot View of the blocks as of now
+       * @throws std::logic_error If enableSnapshots was not called
+       * @throws std::system_error If mapping fails
+       */
+      Snapshot snapshot() {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        if (!this->backing) {
+          throw std::logic_error("Snapshots are not enabled");
+        }
+        this->syncBacking();
+        Snapshot snap(this->backing, this->blockOffsets);
+        for (const auto& it : this->blocks) {
+          this->backing->map(it.second, blockSize, this->blockOffsets.at(it.first), true);
+        }
+        this->copyOnWrite = true;
+        return snap;
+      }
+    #endif
+
+    /**
+     * @brief Returns the number of blocks allocated
+     * 
+     * @return size_t
+     */
+    size_t getNumBlocks() const {
       #ifdef MEMPOOL_THREADSAFE
         std::lock_guard<std::mutex> lock(mutex);
       #endif
-      for (auto it : blocks) {
-        std::free(it.second);
-      }
-      this->curChunk = nullptr;
+      return this->blocks.size();
     }
 
     /**
-     * @brief Allocates object in memory pool, returns shared_ptr to object.
+     * @brief Returns the chunk turnover counters
+     * 
+     * @return PoolStats
+     */
+    PoolStats getStats() const {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      return this->stats;
+    }
+
+    /**
+     * @brief Allocates blocks until the pool has at least numBlocks
      * 
      * @note This function is thread-safe.
      * 
-     * @tparam T The object type to allocate
-     * @tparam V The argument types to pass to the constructor of T
-     * @param v The arguments to pass to the constructor of T
-     * @return std::shared_ptr<T> The allocated object
+     * @param numBlocks Number of blocks the pool should have
      */
-    template <class T, class... V>
-    std::shared_ptr<T> makeShared(V&&... v) {
+    void reserve(size_t numBlocks) {
       #ifdef MEMPOOL_THREADSAFE
         std::lock_guard<std::mutex> lock(mutex);
       #endif
-      if (this->curChunk->head - (char*)this->curChunk + sizeof(T) >= chunkSize) {
-        if (this->curChunk->next == nullptr) {
-          this->allocBlock();
-        } else {
-          this->curChunk = this->curChunk->next;
-        }
+      while (this->blocks.size() < numBlocks) {
+        this->allocBlock();
       }
-      return this->curChunk->template makeShared<T>(this, std::forward<V>(v)...);
     }
 
     /**
-     * @brief Allocates object in memory pool, returns pointer to object
+     * @brief Sets whether the pool may allocate new blocks once all chunks
+     * are in use. A pool that may not grow throws std::bad_alloc instead, so
+     * its memory stays within the blocks it has, e.g. after reserve.
      * 
      * @note This function is thread-safe.
      * 
-     * @tparam T The object type to allocate
-     * @tparam V The argument types to pass to the constructor of T
-     * @param v The arguments to pass to the constructor of T
-     * @return T* The allocated object
+     * @param growable Whether new blocks may be allocated
      */
-    template <class T, class... V>
-    T* make(V&&... v) {
+    void setGrowable(bool growable) {
       #ifdef MEMPOOL_THREADSAFE
         std::lock_guard<std::mutex> lock(mutex);
       #endif
-      if (this->curChunk->head - (char*)this->curChunk + sizeof(T) >= chunkSize) {
-        if (this->curChunk->next == nullptr) {
-          this->allocBlock();
-        } else {
-          this->curChunk = this->curChunk->next;
-        }
-      }
-      return this->curChunk->template make<T>(this, std::forward<V>(v)...);
+      this->growable = growable;
     }
 
     /**
-     * @brief Frees object from memory pool
+     * @brief Calls f(void* block) with the address of every block, each
+     * getBlockSize() bytes long and aligned to its size
      * 
-     * @tparam T Object type
-     * @param obj Pointer to object that was alloc'd in this pool
+     * @note This function is thread-safe.
+     * 
+     * @param f Callable taking void*
      */
-    template <class T>
-    void free(T* obj) {
-      Chunk* chunk;
-      {
+    template <class F>
+    void forEachBlock(F&& f) const {
+      #ifdef MEMPOOL_THREADSAFE
+        std::lock_guard<std::mutex> lock(mutex);
+      #endif
+      for (const auto& it : this->blocks) {
+        f((void*)it.second);
+      }
+    }
+
+    #ifdef MEMPOOL_TYPE_TAGS
+      /**
+       * @brief Calls a visitor for every live allocation, by walking each
+       * chunk from allocation to allocation through their type tags.
+       * 
+       * Without type arguments, f(void* obj, size_t size, const TypeInfo* type)
+       * is called for every allocation, with the bytes it reserved and its
+       * type, nullptr for memory from allocate and arrays. With type
+       * arguments, f(T&) is called for the objects of those types only,
+       * dispatched through a table indexed by tag.
+       * 
+       * @note This function is thread-safe, but f must not allocate in or
+       * free to this pool. Objects whose constructor is still running on
+       * another thread are skipped.
+       * 
+       * @tparam Ts Types to visit, or none to visit everything
+       * @param f Visitor
+       */
+      template <class... Ts, class F>
+      void visit(F&& f) {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        if constexpr (sizeof...(Ts) == 0) {
+          this->walk([&](void* obj, size_t size, uint16_t tag) { f(obj, size, typeInfoOf(tag)); });
+        } else {
+          using Handler = void (*)(void*, F&);
+          const uint16_t tags[] = {tagOf<Ts>()...};
+          const Handler handlers[] = {+[](void* obj, F& f) { f(*(Ts*)obj); }...};
+          std::vector<Handler> table(*std::max_element(std::begin(tags), std::end(tags)) + 1, nullptr);
+          for (size_t i = 0; i < sizeof...(Ts); i++) {
+            table[tags[i]] = handlers[i];
+          }
+          this->walk([&](void* obj, size_t, uint16_t tag) {
+            if (tag < table.size() && table[tag] != nullptr) {
+              table[tag](obj, f);
+            }
+          });
+        }
+      }
+    #endif
+
+    #ifdef MEMPOOL_GC
+      /**
+       * @brief Registers a pointer variable outside the pool as a root of the
+       * collector. Objects it points to when marking, and everything reachable
+       * from them through PoolPointers, survive collection.
+       * 
+       * @note This function is thread-safe.
+       * 
+       * @tparam T Pointee type
+       * @param root The pointer variable, which must stay valid until removed
+       */
+      template <class T>
+      void addRoot(T*& root) {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        this->roots.push_back((void**)&root);
+      }
+
+      /**
+       * @brief Unregisters a root added with addRoot
+       * 
+       * @note This function is thread-safe.
+       * 
+       * @tparam T Pointee type
+       * @param root The pointer variable
+       */
+      template <class T>
+      void removeRoot(T*& root) {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        auto it = std::find(this->roots.begin(), this->roots.end(), (void**)&root);
+        if (it != this->roots.end()) {
+          *it = this->roots.back();
+          this->roots.pop_back();
+        }
+      }
+
+      /**
+       * @brief Marks every allocation reachable from the roots and starts a
+       * sweep of the rest, to be done by sweep. A sweep still pending from
+       * the last mark is finished first.
+       * 
+       * Pointer fields are found through the PoolPointers specialization of
+       * each object's type; types without one are leaves. Pointers must point
+       * to the start of an allocation, and pointers outside the pool are
+       * ignored. Every allocation of the pool is collected when unreachable,
+       * including untyped ones from allocate.
+       * 
+       * Objects must not be modified while marking. Until the sweep is done,
+       * unreachable objects must not be touched, while reachable and new ones
+       * may be used and freed as usual.
+       * 
+       * @note This function is thread-safe.
+       */
+      void mark() {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        this->markReachable();
+      }
+
+      /**
+       * @brief Sweeps up to maxChunks chunks left by mark, running the
+       * destructor of each unmarked object and freeing its memory, so a
+       * collection can be spread over many short steps.
+       * 
+       * @note This function is thread-safe, but destructors run with the
+       * pool locked and must not allocate in or free to this pool.
+       * 
+       * @param maxChunks Most chunks to sweep in this step
+       * @return true If the sweep is done
+       */
+      bool sweep(size_t maxChunks = SIZE_MAX) {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        this->sweepChunks(maxChunks);
+        return this->sweepQueue.empty();
+      }
+
+      /**
+       * @brief Runs a full collection, mark and sweep in one go
+       * 
+       * @note This function is thread-safe, with the restrictions of mark
+       * and sweep.
+       * 
+       * @return size_t Number of allocations freed
+       */
+      size_t collect() {
+        #ifdef MEMPOOL_THREADSAFE
+          std::lock_guard<std::mutex> lock(mutex);
+        #endif
+        this->markReachable();
+        return this->sweepChunks(SIZE_MAX);
+      }
+    #endif
+
+    #ifdef MEMPOOL_TYPE_TAGS
+      /**
+       * @brief Scans for chunks kept in use by few live objects, which hold
+       * on to memory the pool cannot return or reuse, and reports the objects
+       * pinning them by type and allocation site, with the bytes compaction
+       * or allocating them elsewhere would recover.
+       * 
+       * Sites are recorded if MEMPOOL_ALLOC_SITES is defined, see
+       * AllocationScope. The current chunk, still being filled, is skipped.
+       * 
+       * @note This function is thread-safe, but scans every chunk header and
+       * the objects in the pinned chunks with the pool locked.
+       * 
+       * @param maxOccupancy Fraction of a chunk at or below which an occupied
+       * chunk counts as pinned
+       * @return PinningReport
+       */
+      PinningReport pinningReport(double maxOccupancy = 0.25) {
         #ifdef MEMPOOL_THREADSAFE
           std::lock_guard<std::mutex> lock(mutex);
         #endif
-        // assert(this->contains(obj));
-        const size_t blockIdx = this->getBlockIdx((void*)obj);
-        // assert(blocks.count(blockIdx));
-        Chunk* block = blocks.at(blockIdx);
-        const size_t chunkIdx = ((size_t)((char*)obj - (char*)block) / chunkSize);
-        chunk = (Chunk*)(((char*)block) + chunkIdx * chunkSize);
+        this->drainRemote();
+        PinningReport report;
+        std::vector<Block*> sorted;
+        for (const auto& it : this->blocks) {
+          sorted.push_back(it.second);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        // Sources by type tag and site id
+        std::unordered_map<uint64_t, size_t> sourceIndex;
+        std::vector<size_t> chunkSources;
+        size_t used = 0;
+        for (Block* block : sorted) {
+          for (size_t i = headerChunks; i < chunksPerBlock; i++) {
+            const Chunk& chunk = block->chunks[i];
+            if (chunk.empty() || &chunk == this->curChunk) {
+              continue;
+            }
+            report.chunksInUse++;
+            if (chunk.used > maxOccupancy * chunkSize) {
+              continue;
+            }
+            PinnedChunk pinned{chunk.data(), chunk.used, {}};
+            chunkSources.clear();
+            for (size_t pos = 0; pos < chunk.head;) {
+              TagHeader* header = (TagHeader*)((char*)pinned.data + pos);
+              pos += header->size;
+              uint16_t tag = loadTag(header);
+              if (tag == freeTag || tag == paddingTag) {
+                continue;
+              }
+              if (tag == constructingTag) {
+                // Pins the chunk all the same, with its type not known yet
+                tag = untypedTag;
+              }
+              #ifdef MEMPOOL_ALLOC_SITES
+                const uint32_t site = header->site;
+              #else
+                const uint32_t site = noSite;
+              #endif
+              const PinnedObject obj{header + 1, header->size - sizeof(TagHeader), typeInfoOf(tag),
+                                     siteNameOf(site)};
+              auto it = sourceIndex.emplace((uint64_t)tag << 32 | site, report.sources.size()).first;
+              if (it->second == report.sources.size()) {
+                report.sources.push_back(PinningSource{obj.type, obj.site});
+              }
+              PinningSource& source = report.sources[it->second];
+              source.objects++;
+              source.bytes += obj.size;
+              if (std::find(chunkSources.begin(), chunkSources.end(), it->second) == chunkSources.end()) {
+                chunkSources.push_back(it->second);
+                source.chunks++;
+              }
+              report.bytesPinned += obj.size;
+              pinned.objects.push_back(obj);
+            }
+            if (chunkSources.size() == 1) {
+              report.sources[chunkSources[0]].recoverable += chunkSize;
+            }
+            used += chunk.used;
+            report.chunks.push_back(std::move(pinned));
+          }
+        }
+        report.chunksPinned = report.chunks.size();
+        report.compactionRecoverable = report.chunksPinned * chunkSize - alignUp(used, chunkSize);
+        std::sort(report.sources.begin(), report.sources.end(), [](const PinningSource& a, const PinningSource& b) {
+          return a.recoverable != b.recoverable ? a.recoverable > b.recoverable : a.chunks > b.chunks;
+        });
+        return report;
       }
-      this->destructHandler<T>(chunk, obj);
+    #endif
+
+    /**
+     * @brief Returns the block size, chunkSize * chunksPerBlock
+     * 
+     * @return size_t
+     */
+    static constexpr size_t getBlockSize() {
+      return blockSize;
     }
 
     /**
-     * @brief Returns the number of blocks allocated
+     * @brief Returns the chunk size, the largest allocation the pool can serve
      * 
      * @return size_t
      */
-    size_t getNumBlocks() const {
-      #ifdef MEMPOOL_THREADSAFE
-        std::lock_guard<std::mutex> lock(mutex);
-      #endif
-      return this->blocks.size();
+    static constexpr size_t getChunkSize() {
+      return chunkSize;
+    }
+
+    /**
+     * @brief Returns the largest allocation with given alignment the pool can
+     * serve: chunkSize, less room for the type tag header if
+     * MEMPOOL_TYPE_TAGS is defined
+     * 
+     * @param align Alignment of the allocation
+     * @return size_t
+     */
+    static constexpr size_t getMaxAllocSize(size_t align = 1) {
+      return capacity(align);
+    }
+
+    /**
+     * @brief Returns how many objects of given size and alignment fit in one
+     * chunk, counting the type tag header and padding in front of each if
+     * MEMPOOL_TYPE_TAGS is defined
+     * 
+     * @param size Size of each object, at most getMaxAllocSize(align)
+     * @param align Alignment of each object
+     * @return size_t
+     */
+    static constexpr size_t getObjectsPerChunk(size_t size, size_t align = 1) {
+      return (chunkSize - firstOffset(align) - footprint(nonZero(size))) / stride(nonZero(size), align) + 1;
+    }
+
+    /**
+     * @brief Returns the bytes left unused at the end of a chunk holding
+     * getObjectsPerChunk(size, align) objects of given size and alignment
+     * 
+     * @param size Size of each object, at most getMaxAllocSize(align)
+     * @param align Alignment of each object
+     * @return size_t
+     */
+    static constexpr size_t getChunkTail(size_t size, size_t align = 1) {
+      return chunkSize - firstOffset(align) - footprint(nonZero(size)) -
+             (getObjectsPerChunk(size, align) - 1) * stride(nonZero(size), align);
+    }
+
+    /**
+     * @brief Returns the pool an address was allocated from. Every block
+     * starts with a pointer to its pool, so this works for pools of any
+     * geometry sharing the same blockSize.
+     * 
+     * @param ptr Pointer to memory allocated in some pool
+     * @return MemPool* The owning pool
+     */
+    static MemPool* ownerOf(const void* ptr) {
+      return blockOf(ptr)->pool;
     }
   };
 }  // namespace benpm
\ No newline at end of file
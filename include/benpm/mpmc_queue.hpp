@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief Unbounded lock-free multi-producer multi-consumer queue whose nodes
+   * come from a memory pool
+   *
+   * A Michael-Scott queue. Nodes are carved from the pool a chunk at a time
+   * and then recycled through a lock-free free list instead of being returned
+   * to the pool, so enqueue and dequeue only take a lock, and touch the pool,
+   * when the free list runs dry. Since nodes are never released while the
+   * queue lives, threads still reading a dequeued node always read node
+   * memory. Nodes are addressed by 32-bit index so that links, the head, the
+   * tail and the free list fit a tag in one 64-bit word, which rules out ABA
+   * with plain 64-bit compare and swap.
+   *
+   * A dequeued node is recycled once its value has been moved out and it has
+   * been unlinked as the queue's dummy head, whichever happens last.
+   *
+   * All nodes go back to the pool when the queue is destroyed. If the pool is
+   * shared with other threads, define MEMPOOL_THREADSAFE.
+   *
+   * @tparam T Value type, must be nothrow move constructible
+   * @tparam Pool The memory pool type
+   */
+  template <class T, class Pool = MemPool<>>
+  class MPMCQueue {
+  private:  // ------------------------------------------------------------
+    static_assert(std::is_nothrow_move_constructible<T>::value, "Queue values must be nothrow move constructible");
+
+    // Index meaning no node
+    static constexpr uint32_t nil = UINT32_MAX;
+
+    struct Node {
+      std::atomic<uint64_t> next;      // Tagged index of the next node in the queue
+      std::atomic<uint32_t> freeNext;  // Index of the next node in the free list
+      std::atomic<uint32_t> refs;      // Owners left before the node is recycled
+      alignas(T) unsigned char storage[sizeof(T)];
+
+      T* value() { return (T*)this->storage; }
+    };
+
+    // Nodes per chunk sized segment
+    static constexpr size_t segmentNodes = Pool::getMaxAllocSize(alignof(Node)) / sizeof(Node);
+    // Maximum number of segments, bounding the number of nodes
+    static constexpr size_t maxSegments = (size_t)1 << 16;
+
+    static_assert(segmentNodes > 0, "Node is too large for the pool's chunks");
+    static_assert(segmentNodes * maxSegments < nil, "Node indices must fit in 32 bits");
+
+    // A node index with a tag that changes on every update
+    static uint64_t pack(uint32_t idx, uint32_t tag) { return (uint64_t)tag << 32 | idx; }
+    static uint32_t idxOf(uint64_t tagged) { return (uint32_t)tagged; }
+    static uint32_t tagOf(uint64_t tagged) { return (uint32_t)(tagged >> 32); }
+
+    // Directory of node segments
+    struct Directory {
+      size_t capacity;  // Number of segments it can point to
+      std::unique_ptr<std::atomic<Node*>[]> segments;
+    };
+
+    Pool& pool;
+    // Current directory, replaced by one twice the size when full. Segments
+    // are published in it before any of their nodes is reachable
+    std::atomic<Directory*> directory;
+    // All directories ever built. Old ones may still be read by node lookups
+    std::vector<std::unique_ptr<Directory>> directories;
+    // Number of segments, only changed with the mutex held
+    std::atomic<size_t> numSegments;
+    // Dequeue end, always a dummy node whose value is gone
+    alignas(cacheLineSize) std::atomic<uint64_t> head;
+    // Enqueue end, the last node or one behind it
+    alignas(cacheLineSize) std::atomic<uint64_t> tail;
+    // Top of the free list
+    alignas(cacheLineSize) std::atomic<uint64_t> freeHead;
+    // Serializes refills from the pool
+    alignas(cacheLineSize) std::mutex mutex;
+
+    Node& node(uint32_t idx) const {
+      const Directory* dir = this->directory.load(std::memory_order_acquire);
+      return dir->segments[idx / segmentNodes].load(std::memory_order_acquire)[idx % segmentNodes];
+    }
+
+    // Builds a directory with given capacity pointing to the segments so
+    // far. Must be called with the mutex held
+    Directory* buildDirectory(size_t capacity) {
+      auto dir = std::make_unique<Directory>();
+      dir->capacity = capacity;
+      dir->segments = std::make_unique<std::atomic<Node*>[]>(capacity);
+      if (const Directory* old = this->directory.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < old->capacity; i++) {
+          dir->segments[i].store(old->segments[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+      }
+      this->directories.push_back(std::move(dir));
+      return this->directories.back().get();
+    }
+
+    // Pushes the chain of nodes from first to last, linked by freeNext, onto
+    // the free list
+    void pushFree(uint32_t first, uint32_t last) {
+      uint64_t top = this->freeHead.load(std::memory_order_relaxed);
+      do {
+        this->node(last).freeNext.store(idxOf(top), std::memory_order_relaxed);
+      } while (!this->freeHead.compare_exchange_weak(top, pack(first, tagOf(top) + 1), std::memory_order_release,
+                                                     std::memory_order_relaxed));
+    }
+
+    // Pops a node off the free list, or returns nil
+    uint32_t popFree() {
+      uint64_t top = this->freeHead.load(std::memory_order_acquire);
+      while (idxOf(top) != nil) {
+        const uint32_t next = this->node(idxOf(top)).freeNext.load(std::memory_order_relaxed);
+        if (this->freeHead.compare_exchange_weak(top, pack(next, tagOf(top) + 1), std::memory_order_acquire,
+                                                 std::memory_order_acquire)) {
+          return idxOf(top);
+        }
+      }
+      return nil;
+    }
+
+    // Carves a chunk of nodes from the pool onto the free list, unless
+    // another thread refilled it meanwhile. Throws std::bad_alloc once
+    // maxSegments are in use
+    void refill() {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (idxOf(this->freeHead.load(std::memory_order_acquire)) != nil) {
+        return;
+      }
+      const size_t s = this->numSegments.load(std::memory_order_relaxed);
+      if (s == maxSegments) {
+        throw std::bad_alloc();
+      }
+      Directory* dir = this->directory.load(std::memory_order_relaxed);
+      if (s == dir->capacity) {
+        // Full: build a directory of twice the size, published below
+        dir = this->buildDirectory(std::min(dir->capacity * 2, maxSegments));
+      }
+      Node* seg = (Node*)this->pool.allocate(segmentNodes * sizeof(Node), alignof(Node));
+      const uint32_t first = (uint32_t)(s * segmentNodes);
+      for (size_t i = 0; i < segmentNodes; i++) {
+        new (&seg[i].next) std::atomic<uint64_t>(pack(nil, 0));
+        new (&seg[i].freeNext) std::atomic<uint32_t>((uint32_t)(first + i + 1));
+        new (&seg[i].refs) std::atomic<uint32_t>(0);
+      }
+      dir->segments[s].store(seg, std::memory_order_release);
+      this->directory.store(dir, std::memory_order_release);
+      this->numSegments.store(s + 1, std::memory_order_relaxed);
+      this->pushFree(first, (uint32_t)(first + segmentNodes - 1));
+    }
+
+    // Takes a node off the free list, refilling it from the pool if needed
+    uint32_t takeNode() {
+      uint32_t idx;
+      while ((idx = this->popFree()) == nil) {
+        this->refill();
+      }
+      return idx;
+    }
+
+    // Drops one owner of a node, recycling it after the last
+    void release(uint32_t idx) {
+      if (this->node(idx).refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->pushFree(idx, idx);
+      }
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct an empty queue taking its nodes from given pool
+     *
+     * @param pool The pool to carve nodes from
+     */
+    explicit MPMCQueue(Pool& pool) : pool(pool), directory(nullptr), numSegments(0), freeHead(pack(nil, 0)) {
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->directory.store(this->buildDirectory(4), std::memory_order_release);
+      }
+      const uint32_t dummy = this->takeNode();
+      this->node(dummy).refs.store(1, std::memory_order_relaxed);
+      this->head.store(pack(dummy, 0), std::memory_order_relaxed);
+      this->tail.store(pack(dummy, 0), std::memory_order_relaxed);
+    }
+
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    ~MPMCQueue() {
+      // Destruct values still queued, then hand every segment back
+      const uint32_t h = idxOf(this->head.load(std::memory_order_relaxed));
+      for (uint32_t i = idxOf(this->node(h).next.load(std::memory_order_relaxed)); i != nil;
+           i = idxOf(this->node(i).next.load(std::memory_order_relaxed))) {
+        this->node(i).value()->~T();
+      }
+      const Directory* dir = this->directory.load(std::memory_order_relaxed);
+      const size_t n = this->numSegments.load(std::memory_order_relaxed);
+      for (size_t s = 0; s < n; s++) {
+        this->pool.deallocate(dir->segments[s].load(std::memory_order_relaxed), segmentNodes * sizeof(Node));
+      }
+    }
+
+    /**
+     * @brief Constructs a value at the back of the queue
+     *
+     * @note This function is thread-safe, and lock-free unless all nodes are
+     * in use.
+     *
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @throws std::bad_alloc If the queue holds too many values
+     */
+    template <class... V>
+    void enqueue(V&&... v) {
+      const uint32_t idx = this->takeNode();
+      Node& n = this->node(idx);
+      try {
+        new (n.storage) T(std::forward<V>(v)...);
+      } catch (...) {
+        this->pushFree(idx, idx);
+        throw;
+      }
+      // One owner for the value and one for the link
+      n.refs.store(2, std::memory_order_relaxed);
+      // Bump the tag so a stale enqueue on the node's previous life fails
+      n.next.store(pack(nil, tagOf(n.next.load(std::memory_order_relaxed)) + 1), std::memory_order_relaxed);
+      for (;;) {
+        uint64_t tail = this->tail.load(std::memory_order_acquire);
+        Node& t = this->node(idxOf(tail));
+        uint64_t next = t.next.load(std::memory_order_acquire);
+        if (tail != this->tail.load(std::memory_order_acquire)) {
+          continue;
+        }
+        if (idxOf(next) == nil) {
+          if (t.next.compare_exchange_weak(next, pack(idx, tagOf(next) + 1), std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+            this->tail.compare_exchange_strong(tail, pack(idx, tagOf(tail) + 1), std::memory_order_release,
+                                               std::memory_order_relaxed);
+            return;
+          }
+        } else {
+          // Tail fell behind, help move it
+          this->tail.compare_exchange_strong(tail, pack(idxOf(next), tagOf(tail) + 1), std::memory_order_release,
+                                             std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /**
+     * @brief Moves the value at the front of the queue out, if any
+     *
+     * @note This function is thread-safe and lock-free.
+     *
+     * @param out Receives the value
+     * @return true If a value was dequeued
+     * @return false If the queue was empty
+     */
+    bool dequeue(T& out) {
+      for (;;) {
+        uint64_t head = this->head.load(std::memory_order_acquire);
+        uint64_t tail = this->tail.load(std::memory_order_acquire);
+        const uint64_t next = this->node(idxOf(head)).next.load(std::memory_order_acquire);
+        if (head != this->head.load(std::memory_order_acquire)) {
+          continue;
+        }
+        if (idxOf(head) == idxOf(tail)) {
+          if (idxOf(next) == nil) {
+            return false;
+          }
+          // Tail fell behind, help move it
+          this->tail.compare_exchange_strong(tail, pack(idxOf(next), tagOf(tail) + 1), std::memory_order_release,
+                                             std::memory_order_relaxed);
+        } else if (this->head.compare_exchange_weak(head, pack(idxOf(next), tagOf(head) + 1),
+                                                    std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          // next is the new dummy. Its value is ours alone, and the node stays
+          // alive until released here, even if another dequeue unlinks it
+          T* value = this->node(idxOf(next)).value();
+          out = std::move(*value);
+          value->~T();
+          this->release(idxOf(next));
+          this->release(idxOf(head));
+          return true;
+        }
+      }
+    }
+
+    /**
+     * @brief Returns the number of nodes carved from the pool so far
+     *
+     * @return size_t
+     */
+    size_t getNumNodes() const {
+      return this->numSegments.load(std::memory_order_relaxed) * segmentNodes;
+    }
+  };
+}  // namespace benpm
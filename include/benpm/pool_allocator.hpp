@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  namespace detail {
+    // Allocates memory too large for a pool from the global operator new
+    inline void* upstreamAllocate(size_t size, size_t align) {
+      if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return ::operator new(size, std::align_val_t(align));
+      }
+      return ::operator new(size);
+    }
+
+    inline void upstreamDeallocate(void* ptr, size_t size, size_t align) {
+      if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        ::operator delete(ptr, size, std::align_val_t(align));
+      } else {
+        ::operator delete(ptr, size);
+      }
+    }
+
+    // Constructs T in the pool with uses-allocator construction: if T is
+    // allocator-aware for Alloc, alloc is passed down, leading
+    // (std::allocator_arg) or trailing
+    template <class T, class Pool, class Alloc, class... V>
+    T* makeUsingAllocator(Pool& pool, const Alloc& alloc, V&&... v) {
+      if constexpr (!std::uses_allocator<T, Alloc>::value) {
+        return pool.template make<T>(std::forward<V>(v)...);
+      } else if constexpr (std::is_constructible<T, std::allocator_arg_t, const Alloc&, V...>::value) {
+        return pool.template make<T>(std::allocator_arg, alloc, std::forward<V>(v)...);
+      } else {
+        static_assert(std::is_constructible<T, V..., const Alloc&>::value,
+                      "Allocator-aware type takes no allocator with these arguments");
+        return pool.template make<T>(std::forward<V>(v)..., alloc);
+      }
+    }
+  }  // namespace detail
+
+  /**
+   * @brief Standard allocator drawing from a memory pool
+   *
+   * Allocations that fit in a chunk come from the pool; larger ones, such as
+   * a long vector's buffer, fall back to the global operator new. Copies,
+   * rebinds and containers using it all share the pool, and it propagates
+   * with its container. Combined with std::scoped_allocator_adaptor, or with
+   * makeScoped for a single object, members of pool allocated objects end up
+   * in the same pool.
+   *
+   * Containers that grow from several threads need MEMPOOL_THREADSAFE.
+   *
+   * @tparam T Value type
+   * @tparam Pool The memory pool type
+   */
+  template <class T, class Pool = MemPool<>>
+  class PoolAllocator {
+  private:  // ------------------------------------------------------------
+    Pool* pool;
+
+  public:  // ------------------------------------------------------------
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <class U>
+    struct rebind {
+      using other = PoolAllocator<U, Pool>;
+    };
+
+    explicit PoolAllocator(Pool& pool) noexcept : pool(&pool) {}
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, Pool>& other) noexcept : pool(&other.getPool()) {}
+
+    T* allocate(size_t n) {
+      if (n > Pool::getMaxAllocSize(alignof(T)) / sizeof(T)) {
+        return (T*)detail::upstreamAllocate(n * sizeof(T), alignof(T));
+      }
+      return (T*)this->pool->allocate(n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+      if (n > Pool::getMaxAllocSize(alignof(T)) / sizeof(T)) {
+        detail::upstreamDeallocate(ptr, n * sizeof(T), alignof(T));
+      } else {
+        this->pool->deallocate(ptr, n * sizeof(T));
+      }
+    }
+
+    /**
+     * @brief Returns the pool this allocator draws from
+     */
+    Pool& getPool() const { return *this->pool; }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U, Pool>& other) const { return this->pool == &other.getPool(); }
+    template <class U>
+    bool operator!=(const PoolAllocator<U, Pool>& other) const { return this->pool != &other.getPool(); }
+  };
+
+  /**
+   * @brief Allocates object in a pool, passing a PoolAllocator for the same
+   * pool to its constructor if it is allocator-aware, so its members
+   * allocate from the pool too. Free it with the pool's free as usual.
+   *
+   * @tparam T The object type to allocate
+   * @tparam Pool The memory pool type
+   * @tparam V The argument types to pass to the constructor of T
+   * @param pool The pool to allocate the object and its members in
+   * @param v The arguments to pass to the constructor of T
+   * @return T* The allocated object
+   */
+  template <class T, class Pool, class... V>
+  T* makeScoped(Pool& pool, V&&... v) {
+    return detail::makeUsingAllocator<T>(pool, PoolAllocator<std::byte, Pool>(pool), std::forward<V>(v)...);
+  }
+
+  /**
+   * @brief Polymorphic memory resource drawing from a memory pool
+   *
+   * Lets std::pmr containers and strings allocate from a pool. Requests that
+   * do not fit in a chunk go to an upstream resource. make constructs an
+   * object in the pool and, if it is pmr allocator-aware, hands it this
+   * resource, so e.g. a std::pmr::string member lives in the same chunks as
+   * the object holding it.
+   *
+   * @tparam Pool The memory pool type
+   */
+  template <class Pool = MemPool<>>
+  class PoolResource : public std::pmr::memory_resource {
+  private:  // ------------------------------------------------------------
+    Pool& pool;
+    std::pmr::memory_resource* upstream;
+
+    static bool fits(size_t bytes, size_t align) {
+      return align <= Pool::getChunkSize() && bytes <= Pool::getMaxAllocSize(align);
+    }
+
+    void* do_allocate(size_t bytes, size_t align) override {
+      if (!fits(bytes, align)) {
+        return this->upstream->allocate(bytes, align);
+      }
+      return this->pool.allocate(bytes, align);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t align) override {
+      if (!fits(bytes, align)) {
+        this->upstream->deallocate(ptr, bytes, align);
+      } else {
+        this->pool.deallocate(ptr, bytes);
+      }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+      return this == &other;
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct a resource over given pool
+     *
+     * @param pool The pool to allocate from
+     * @param upstream Resource for requests larger than a chunk
+     */
+    explicit PoolResource(Pool& pool, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : pool(pool), upstream(upstream) {}
+
+    /**
+     * @brief Allocates object in the pool, passing this resource to its
+     * constructor if it is pmr allocator-aware. Free it with free.
+     *
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object
+     */
+    template <class T, class... V>
+    T* make(V&&... v) {
+      return detail::makeUsingAllocator<T>(this->pool, std::pmr::polymorphic_allocator<std::byte>(this),
+                                           std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Frees object allocated with make, after its members released
+     * their memory
+     *
+     * @tparam T Object type
+     * @param obj Pointer to object
+     */
+    template <class T>
+    void free(T* obj) {
+      this->pool.free(obj);
+    }
+
+    /**
+     * @brief Returns the underlying pool
+     */
+    Pool& getPool() const { return this->pool; }
+  };
+}  // namespace benpm
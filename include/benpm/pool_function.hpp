@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  template <class Sig, class Pool = MemPool<>, size_t bufferSize = 3 * sizeof(void*)>
+  class PoolFunction;
+
+  /**
+   * @brief Move-only type-erased callable that never allocates from the
+   * system allocator
+   *
+   * Callables of up to bufferSize bytes that are nothrow movable are stored
+   * inline. Larger ones are allocated in a memory pool and found again through
+   * the owning pool's block header, so the function object itself is just the
+   * buffer and a pointer to a static table of three functions per callable
+   * type.
+   *
+   * A callable stored in a pool is freed with MemPool::free when the function
+   * is destroyed, so unless MEMPOOL_THREADSAFE is defined, that must happen on
+   * the pool's thread.
+   *
+   * @tparam R Return type
+   * @tparam Args Argument types
+   * @tparam Pool The memory pool type oversize callables are allocated in
+   * @tparam bufferSize Size in bytes of the inline buffer
+   */
+  template <class R, class... Args, class Pool, size_t bufferSize>
+  class PoolFunction<R(Args...), Pool, bufferSize> {
+  private:  // ------------------------------------------------------------
+    static_assert(bufferSize >= sizeof(void*), "Buffer must be able to hold a pointer");
+
+    struct VTable {
+      R (*invoke)(void* storage, Args&&... args);
+      // Move constructs into dst and destructs what is left in src
+      void (*move)(void* dst, void* src);
+      void (*destroy)(void* storage);
+    };
+
+    // Returns true if callables of type F are stored inline
+    template <class F>
+    static constexpr bool isInline() {
+      return sizeof(F) <= bufferSize && alignof(F) <= alignof(std::max_align_t) &&
+             std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template <class F>
+    struct Inline {
+      static R invoke(void* storage, Args&&... args) {
+        return (*(F*)storage)(std::forward<Args>(args)...);
+      }
+      static void move(void* dst, void* src) {
+        new (dst) F(std::move(*(F*)src));
+        ((F*)src)->~F();
+      }
+      static void destroy(void* storage) {
+        ((F*)storage)->~F();
+      }
+      static constexpr VTable vtable = {&invoke, &move, &destroy};
+    };
+
+    template <class F>
+    struct Pooled {
+      static R invoke(void* storage, Args&&... args) {
+        return (**(F**)storage)(std::forward<Args>(args)...);
+      }
+      static void move(void* dst, void* src) {
+        *(F**)dst = *(F**)src;
+      }
+      static void destroy(void* storage) {
+        F* f = *(F**)storage;
+        Pool::ownerOf(f)->free(f);
+      }
+      static constexpr VTable vtable = {&invoke, &move, &destroy};
+    };
+
+    alignas(std::max_align_t) unsigned char buffer[bufferSize];
+    const VTable* vtable = nullptr;
+
+  public:  // ------------------------------------------------------------
+    PoolFunction() = default;
+    PoolFunction(std::nullptr_t) {}
+
+    /**
+     * @brief Construct a function holding a callable small enough to be
+     * stored inline
+     *
+     * @tparam F Callable type
+     * @param f The callable
+     */
+    template <class F, class D = std::decay_t<F>,
+              class = std::enable_if_t<!std::is_same<D, PoolFunction>::value>>
+    PoolFunction(F&& f) {
+      static_assert(isInline<D>(), "Callable does not fit inline, pass a pool to store it in");
+      new (this->buffer) D(std::forward<F>(f));
+      this->vtable = &Inline<D>::vtable;
+    }
+
+    /**
+     * @brief Construct a function holding a callable, which is stored in given
+     * pool unless it fits inline
+     *
+     * @tparam F Callable type
+     * @param pool The pool to allocate an oversize callable in
+     * @param f The callable
+     */
+    template <class F, class D = std::decay_t<F>>
+    PoolFunction(Pool& pool, F&& f) {
+      if constexpr (isInline<D>()) {
+        (void)pool;
+        new (this->buffer) D(std::forward<F>(f));
+        this->vtable = &Inline<D>::vtable;
+      } else {
+        *(D**)this->buffer = pool.template make<D>(std::forward<F>(f));
+        this->vtable = &Pooled<D>::vtable;
+      }
+    }
+
+    PoolFunction(PoolFunction&& other) noexcept : vtable(other.vtable) {
+      if (this->vtable != nullptr) {
+        this->vtable->move(this->buffer, other.buffer);
+        other.vtable = nullptr;
+      }
+    }
+
+    PoolFunction& operator=(PoolFunction&& other) noexcept {
+      if (this != &other) {
+        this->reset();
+        if (other.vtable != nullptr) {
+          other.vtable->move(this->buffer, other.buffer);
+          this->vtable = other.vtable;
+          other.vtable = nullptr;
+        }
+      }
+      return *this;
+    }
+
+    PoolFunction(const PoolFunction&) = delete;
+    PoolFunction& operator=(const PoolFunction&) = delete;
+
+    ~PoolFunction() {
+      this->reset();
+    }
+
+    /**
+     * @brief Destroys the held callable, if any, leaving the function empty
+     */
+    void reset() {
+      if (this->vtable != nullptr) {
+        this->vtable->destroy(this->buffer);
+        this->vtable = nullptr;
+      }
+    }
+
+    /**
+     * @brief Calls the held callable
+     *
+     * @throws std::bad_function_call If the function is empty
+     */
+    R operator()(Args... args) {
+      if (this->vtable == nullptr) {
+        throw std::bad_function_call();
+      }
+      return this->vtable->invoke(this->buffer, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Returns true if the function holds a callable
+     */
+    explicit operator bool() const {
+      return this->vtable != nullptr;
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <utility>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief Front end over several memory pools with different chunk sizes
+   *
+   * Small objects go to pools with small chunks and large objects to pools with
+   * large chunks, so a 24 byte node and a 6KiB buffer both fill their chunks
+   * well. make<T>() picks the pool at compile time from sizeof(T); allocate()
+   * picks it through a constexpr lookup table. All pools share one blockSize,
+   * so free() finds the owning pool from the header of the block an address
+   * lies in.
+   *
+   * @tparam blockSize Size in bytes of blocks in every pool. Must be a power of 2!
+   * @tparam chunkSizes Chunk sizes of the pools, ascending. Must be powers of 2!
+   */
+  template <size_t blockSize, size_t... chunkSizes>
+  class PoolRouter {
+  public:  // ------------------------------------------------------------
+    // Minimum number of objects a pool's chunk must hold to be picked for
+    // them, unless it is the last pool
+    static constexpr size_t minSlots = 8;
+    // Number of pools
+    static constexpr size_t numPools = sizeof...(chunkSizes);
+
+  private:  // ------------------------------------------------------------
+    static constexpr size_t sizes[numPools] = {chunkSizes...};
+
+    static_assert(numPools > 0, "PoolRouter needs at least one chunk size");
+    static_assert(((blockSize % chunkSizes == 0) && ...), "Chunk sizes must divide blockSize");
+
+    // Returns true if chunk sizes are strictly ascending
+    static constexpr bool ascending() {
+      for (size_t i = 1; i < numPools; i++) {
+        if (sizes[i] <= sizes[i - 1]) {
+          return false;
+        }
+      }
+      return true;
+    }
+    static_assert(ascending(), "Chunk sizes must be strictly ascending");
+
+    /**
+     * Returns the pool for objects of given size: the first whose chunks hold
+     * at least minSlots of them, or else the last pool. Only depends on
+     * ceilLog2(size), since chunk sizes and minSlots are powers of 2.
+     */
+    static constexpr size_t route(size_t size) {
+      for (size_t i = 0; i + 1 < numPools; i++) {
+        if (size <= sizes[i] / minSlots) {
+          return i;
+        }
+      }
+      return numPools - 1;
+    }
+
+    // Pool index by ceilLog2 of the allocation size
+    static constexpr std::array<uint8_t, 65> makeTable() {
+      std::array<uint8_t, 65> table = {};
+      for (size_t bits = 0; bits < 64; bits++) {
+        table[bits] = (uint8_t)route((size_t)1 << bits);
+      }
+      table[64] = (uint8_t)(numPools - 1);
+      return table;
+    }
+    static constexpr std::array<uint8_t, 65> table = makeTable();
+
+    std::tuple<MemPool<chunkSizes, blockSize / chunkSizes>...> pools;
+
+    // Calls f with the pool owning ptr. Every block starts with a pointer to
+    // the pool that owns it, whatever that pool's chunk size.
+    template <class F, size_t... I>
+    void withOwner(const void* ptr, F&& f, std::index_sequence<I...>) {
+      void* owner = *(void* const*)((uintptr_t)ptr & ~(uintptr_t)(blockSize - 1));
+      const bool found = ((owner == (void*)&std::get<I>(this->pools) ? (f(std::get<I>(this->pools)), true) : false) || ...);
+      (void)found;
+      assert(found);
+    }
+
+  public:  // ------------------------------------------------------------
+    // Returns ceil(log2(n)), the number of bits needed for n - 1
+    static constexpr size_t ceilLog2(size_t n) {
+      size_t bits = 0;
+      while (bits < 64 && ((size_t)1 << bits) < n) {
+        bits++;
+      }
+      return bits;
+    }
+
+    /**
+     * @brief Returns the index of the pool objects of type T are allocated in
+     */
+    template <class T>
+    static constexpr size_t poolFor() {
+      static_assert(allocSize<T>() <= sizes[numPools - 1], "Object is too large for the largest chunk size");
+      return route(allocSize<T>());
+    }
+
+    /**
+     * @brief Returns the index of the pool allocations of given size go to
+     */
+    static size_t poolFor(size_t size) {
+      return table[ceilLog2(size)];
+    }
+
+    /**
+     * @brief Allocates object in the pool for its size, returns pointer to
+     * object
+     *
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object
+     */
+    template <class T, class... V>
+    T* make(V&&... v) {
+      return std::get<poolFor<T>()>(this->pools).template make<T>(std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Allocates object in the pool for its size, returns shared_ptr to
+     * object
+     *
+     * @tparam T The object type to allocate
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return std::shared_ptr<T> The allocated object
+     */
+    template <class T, class... V>
+    std::shared_ptr<T> makeShared(V&&... v) {
+      return std::get<poolFor<T>()>(this->pools).template makeShared<T>(std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Frees object from the pool that owns it
+     *
+     * @tparam T Object type
+     * @param obj Pointer to object that was alloc'd in this router
+     */
+    template <class T>
+    void free(T* obj) {
+      this->withOwner(obj, [obj](auto& pool) { pool.free(obj); }, std::make_index_sequence<numPools>());
+    }
+
+    /**
+     * @brief Allocates uninitialized memory in the pool for its size
+     *
+     * @param size Number of bytes to allocate
+     * @param align Alignment of the memory, a power of 2
+     * @return void* The allocated memory
+     * @throws std::bad_alloc If size exceeds the largest chunk size
+     */
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+      return this->allocateIn(poolFor(size), size, align);
+    }
+
+    /**
+     * @brief Frees memory returned by allocate
+     *
+     * @param ptr Pointer to memory that was allocated in this router
+     * @param size Number of bytes that were allocated
+     */
+    void deallocate(void* ptr, size_t size) {
+      this->withOwner(ptr, [ptr, size](auto& pool) { pool.deallocate(ptr, size); },
+                      std::make_index_sequence<numPools>());
+    }
+
+    /**
+     * @brief Allocates uninitialized memory in a given pool, regardless of size
+     *
+     * @param pool Index of the pool
+     * @param size Number of bytes to allocate
+     * @param align Alignment of the memory, a power of 2
+     * @return void* The allocated memory
+     * @throws std::bad_alloc If size exceeds the pool's chunk size
+     */
+    void* allocateIn(size_t pool, size_t size, size_t align = alignof(std::max_align_t)) {
+      void* ptr = nullptr;
+      this->withPool(pool, [&](auto& p) { ptr = p.allocate(size, align); }, std::make_index_sequence<numPools>());
+      return ptr;
+    }
+
+    /**
+     * @brief Returns the chunk turnover counters of a given pool
+     *
+     * @param pool Index of the pool
+     * @return PoolStats
+     */
+    PoolStats getStats(size_t pool) const {
+      PoolStats stats;
+      this->withPool(pool, [&](const auto& p) { stats = p.getStats(); }, std::make_index_sequence<numPools>());
+      return stats;
+    }
+
+    /**
+     * @brief Returns the chunk size of a given pool
+     */
+    static constexpr size_t chunkSizeOf(size_t pool) { return sizes[pool]; }
+
+    /**
+     * @brief Returns the number of blocks allocated across all pools
+     *
+     * @return size_t
+     */
+    size_t getNumBlocks() const {
+      return std::apply([](const auto&... pool) { return (pool.getNumBlocks() + ...); }, this->pools);
+    }
+
+  private:  // ------------------------------------------------------------
+    // Calls f with the pool at a runtime index
+    template <class F, size_t... I>
+    void withPool(size_t pool, F&& f, std::index_sequence<I...>) {
+      ((pool == I ? (f(std::get<I>(this->pools)), true) : false) || ...);
+    }
+
+    template <class F, size_t... I>
+    void withPool(size_t pool, F&& f, std::index_sequence<I...>) const {
+      ((pool == I ? (f(std::get<I>(this->pools)), true) : false) || ...);
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief Growable sequence built from pool allocated, fixed size segments
+   *
+   * Each segment holds the largest power of 2 number of elements that fits in
+   * a chunk, so element i lives at segments[i >> shift][i & mask]. Appending
+   * fills the last segment and then allocates a new one from the pool:
+   * elements are never moved or copied once constructed, and pointers to them
+   * stay valid until they are popped. Only the segment index, one pointer
+   * per segment, grows like a std::vector.
+   *
+   * Segments are contiguous arrays, so forEachSegment hands out plain
+   * pointer ranges that the compiler can vectorize loops over.
+   *
+   * Segments are kept when elements are popped or cleared, and returned to
+   * the pool when the vector is destroyed.
+   *
+   * @tparam T Element type
+   * @tparam Pool The memory pool type segments are allocated in
+   */
+  template <class T, class Pool = MemPool<>>
+  class PoolVector {
+  private:  // ------------------------------------------------------------
+    static_assert(sizeof(T) <= Pool::getMaxAllocSize(alignof(T)), "Element is too large for the pool's chunks");
+
+    // Returns floor(log2(n)) for n > 0
+    static constexpr size_t floorLog2(size_t n) {
+      size_t bits = 0;
+      while (n >>= 1) {
+        bits++;
+      }
+      return bits;
+    }
+
+  public:  // ------------------------------------------------------------
+    // log2 of the number of elements per segment
+    static constexpr size_t segmentShift = floorLog2(Pool::getMaxAllocSize(alignof(T)) / sizeof(T));
+    // Number of elements per segment
+    static constexpr size_t segmentSize = (size_t)1 << segmentShift;
+
+  private:  // ------------------------------------------------------------
+    static constexpr size_t segmentMask = segmentSize - 1;
+
+    Pool& pool;
+    std::vector<T*> segments;
+    size_t count = 0;
+
+    void destroyAll() {
+      if constexpr (!std::is_trivially_destructible<T>::value) {
+        for (size_t i = 0; i < this->count; i++) {
+          (*this)[i].~T();
+        }
+      }
+      this->count = 0;
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Random access iterator over the elements
+     */
+    template <class V>
+    class Iterator {
+    private:
+      V* const* segments;
+      size_t i;
+
+    public:
+      using iterator_category = std::random_access_iterator_tag;
+      using value_type = std::remove_const_t<V>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = V*;
+      using reference = V&;
+
+      Iterator(V* const* segments, size_t i) : segments(segments), i(i) {}
+
+      V& operator*() const { return this->segments[this->i >> segmentShift][this->i & segmentMask]; }
+      V* operator->() const { return &**this; }
+      V& operator[](difference_type n) const { return *(*this + n); }
+      Iterator& operator++() { this->i++; return *this; }
+      Iterator operator++(int) { Iterator it = *this; this->i++; return it; }
+      Iterator& operator--() { this->i--; return *this; }
+      Iterator operator--(int) { Iterator it = *this; this->i--; return it; }
+      Iterator& operator+=(difference_type n) { this->i += n; return *this; }
+      Iterator& operator-=(difference_type n) { this->i -= n; return *this; }
+      Iterator operator+(difference_type n) const { return Iterator(this->segments, this->i + n); }
+      Iterator operator-(difference_type n) const { return Iterator(this->segments, this->i - n); }
+      difference_type operator-(const Iterator& other) const { return (difference_type)this->i - (difference_type)other.i; }
+      bool operator==(const Iterator& other) const { return this->i == other.i; }
+      bool operator!=(const Iterator& other) const { return this->i != other.i; }
+      bool operator<(const Iterator& other) const { return this->i < other.i; }
+      bool operator>(const Iterator& other) const { return this->i > other.i; }
+      bool operator<=(const Iterator& other) const { return this->i <= other.i; }
+      bool operator>=(const Iterator& other) const { return this->i >= other.i; }
+    };
+
+    using iterator = Iterator<T>;
+    using const_iterator = Iterator<const T>;
+
+    /**
+     * @brief Construct an empty vector allocating its segments in given pool
+     *
+     * @param pool The pool to allocate segments in
+     */
+    explicit PoolVector(Pool& pool) : pool(pool) {}
+
+    PoolVector(const PoolVector&) = delete;
+    PoolVector& operator=(const PoolVector&) = delete;
+
+    ~PoolVector() {
+      this->destroyAll();
+      for (T* segment : this->segments) {
+        this->pool.deallocate(segment, segmentSize * sizeof(T));
+      }
+    }
+
+    /**
+     * @brief Constructs an element at the end, returns a reference to it. No
+     * existing element moves.
+     *
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T& The new element
+     */
+    template <class... V>
+    T& emplaceBack(V&&... v) {
+      if ((this->count >> segmentShift) == this->segments.size()) {
+        this->segments.push_back((T*)this->pool.allocate(segmentSize * sizeof(T), alignof(T)));
+      }
+      T* slot = &this->segments[this->count >> segmentShift][this->count & segmentMask];
+      new (slot) T(std::forward<V>(v)...);
+      this->count++;
+      return *slot;
+    }
+
+    /**
+     * @brief Copies or moves an element to the end
+     */
+    void pushBack(const T& value) { this->emplaceBack(value); }
+    void pushBack(T&& value) { this->emplaceBack(std::move(value)); }
+
+    /**
+     * @brief Destructs the last element. Its segment is kept for reuse.
+     */
+    void popBack() {
+      this->count--;
+      (*this)[this->count].~T();
+    }
+
+    /**
+     * @brief Destructs all elements. Segments are kept for reuse.
+     */
+    void clear() {
+      this->destroyAll();
+    }
+
+    T& operator[](size_t i) { return this->segments[i >> segmentShift][i & segmentMask]; }
+    const T& operator[](size_t i) const { return this->segments[i >> segmentShift][i & segmentMask]; }
+
+    T& back() { return (*this)[this->count - 1]; }
+    const T& back() const { return (*this)[this->count - 1]; }
+
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+
+    iterator begin() { return iterator(this->segments.data(), 0); }
+    iterator end() { return iterator(this->segments.data(), this->count); }
+    const_iterator begin() const { return const_iterator(this->segments.data(), 0); }
+    const_iterator end() const { return const_iterator(this->segments.data(), this->count); }
+
+    /**
+     * @brief Calls f(T* data, size_t n) for every segment in order, with the
+     * segment's n elements stored contiguously at data. Prefer this over
+     * iterators for tight loops.
+     *
+     * @param f Callable taking T* and size_t
+     */
+    template <class F>
+    void forEachSegment(F&& f) {
+      const size_t full = this->count >> segmentShift;
+      for (size_t s = 0; s < full; s++) {
+        f(this->segments[s], segmentSize);
+      }
+      if ((this->count & segmentMask) != 0) {
+        f(this->segments[full], this->count & segmentMask);
+      }
+    }
+
+    template <class F>
+    void forEachSegment(F&& f) const {
+      const size_t full = this->count >> segmentShift;
+      for (size_t s = 0; s < full; s++) {
+        f((const T*)this->segments[s], segmentSize);
+      }
+      if ((this->count & segmentMask) != 0) {
+        f((const T*)this->segments[full], this->count & segmentMask);
+      }
+    }
+
+    /**
+     * @brief Returns the number of segments allocated
+     *
+     * @return size_t
+     */
+    size_t getNumSegments() const {
+      return this->segments.size();
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mempool.hpp"
+
+#if !defined(__linux__)
+  #error "registered_buffers.hpp requires Linux io_uring"
+#endif
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace benpm {
+  /**
+   * @brief Pool of I/O buffers registered with an io_uring instance as fixed
+   * buffers
+   *
+   * A fixed number of blocks is reserved up front and registered with
+   * IORING_REGISTER_BUFFERS, one registered buffer per block, after which the
+   * pool is not allowed to grow. The kernel pins the pages once at
+   * registration, so IORING_OP_READ_FIXED / IORING_OP_WRITE_FIXED on these
+   * buffers skip per-I/O page pinning. Buffers are carved from the blocks'
+   * chunks like any pool allocation and handed out as refcounted handles
+   * carrying the registered buffer index to put in the SQE's buf_index. The
+   * memory returns to the pool when the last handle is dropped, typically on
+   * completion.
+   *
+   * The ring must outlive the pool. The pool is thread-safe: handles may be
+   * acquired and dropped on any thread.
+   *
+   * @tparam chunkSize Size in bytes of chunks, the largest buffer. Must be a power of 2!
+   * @tparam chunksPerBlock Number of chunks per registered block. Must be a power of 2!
+   */
+  template <size_t chunkSize = 65536, size_t chunksPerBlock = 32>
+  class RegisteredBufferPool {
+  private:  // ------------------------------------------------------------
+    using Pool = MemPool<chunkSize, chunksPerBlock>;
+
+    struct Control {
+      std::atomic<uint32_t> refs;
+      uint32_t size;
+      uint16_t index;
+      char* data;
+      RegisteredBufferPool* owner;
+
+      Control(uint32_t size, uint16_t index, char* data, RegisteredBufferPool* owner)
+          : refs(1), size(size), index(index), data(data), owner(owner) {}
+    };
+
+    int ringFd;
+    // Registered memory, which buffers are carved from
+    Pool pool;
+    // Handle control blocks, kept out of the registered memory
+    MemPool<> controls;
+    // Registered buffer index by block address
+    std::unordered_map<uintptr_t, uint16_t> indices;
+    std::mutex mutex;
+
+    static int registerCall(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+      return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+    }
+
+    void release(Control* control) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->pool.deallocate(control->data, control->size);
+      this->controls.free(control);
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Refcounted handle to a registered buffer. Copies share the
+     * buffer, which goes back to the pool when the last one is dropped.
+     */
+    class Buffer {
+    private:
+      friend class RegisteredBufferPool;
+      Control* control = nullptr;
+
+      explicit Buffer(Control* control) : control(control) {}
+
+    public:
+      Buffer() = default;
+
+      Buffer(const Buffer& other) : control(other.control) {
+        if (this->control != nullptr) {
+          this->control->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      Buffer(Buffer&& other) noexcept : control(other.control) {
+        other.control = nullptr;
+      }
+
+      Buffer& operator=(Buffer other) noexcept {
+        std::swap(this->control, other.control);
+        return *this;
+      }
+
+      ~Buffer() {
+        this->reset();
+      }
+
+      /**
+       * @brief Drops this handle, returning the buffer if it was the last
+       */
+      void reset() {
+        if (this->control != nullptr && this->control->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          this->control->owner->release(this->control);
+        }
+        this->control = nullptr;
+      }
+
+      // Start of the buffer
+      char* data() const { return this->control->data; }
+      // Size of the buffer in bytes
+      size_t size() const { return this->control->size; }
+      // Registered buffer index, for the SQE's buf_index
+      uint16_t bufIndex() const { return this->control->index; }
+
+      explicit operator bool() const { return this->control != nullptr; }
+    };
+
+    /**
+     * @brief Reserves numBlocks blocks and registers them with a ring
+     *
+     * @param ringFd File descriptor of the io_uring instance
+     * @param numBlocks Number of blocks to reserve, at most 16384
+     * @throws std::system_error If registration fails, e.g. because it
+     * exceeds RLIMIT_MEMLOCK
+     */
+    RegisteredBufferPool(int ringFd, size_t numBlocks) : ringFd(ringFd) {
+      if (numBlocks == 0 || numBlocks > 16384) {
+        throw std::invalid_argument("numBlocks must be between 1 and 16384");
+      }
+      this->pool.reserve(numBlocks);
+      this->pool.setGrowable(false);
+      std::vector<iovec> iovecs;
+      this->pool.forEachBlock([&](void* block) {
+        this->indices.emplace((uintptr_t)block, (uint16_t)iovecs.size());
+        iovecs.push_back(iovec{block, Pool::getBlockSize()});
+      });
+      if (registerCall(ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), (unsigned)iovecs.size()) < 0) {
+        throw std::system_error(errno, std::generic_category(), "IORING_REGISTER_BUFFERS");
+      }
+    }
+
+    RegisteredBufferPool(const RegisteredBufferPool&) = delete;
+    RegisteredBufferPool& operator=(const RegisteredBufferPool&) = delete;
+
+    /**
+     * @brief Unregisters the buffers. All handles must have been dropped.
+     */
+    ~RegisteredBufferPool() {
+      registerCall(this->ringFd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    }
+
+    /**
+     * @brief Takes a buffer from registered memory
+     *
+     * @note This function is thread-safe.
+     *
+     * @param size Size of the buffer in bytes, at most chunkSize
+     * @param align Alignment of the buffer, a power of 2. The default suits
+     * O_DIRECT
+     * @return Buffer Handle to the buffer
+     * @throws std::bad_alloc If the registered memory is exhausted or size
+     * exceeds chunkSize
+     */
+    Buffer acquire(size_t size, size_t align = 4096) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      char* data = (char*)this->pool.allocate(size, align);
+      const uint16_t index = this->indices.at((uintptr_t)data & ~(uintptr_t)(Pool::getBlockSize() - 1));
+      try {
+        return Buffer(this->controls.template make<Control>((uint32_t)size, index, data, this));
+      } catch (...) {
+        this->pool.deallocate(data, size);
+        throw;
+      }
+    }
+
+    /**
+     * @brief Returns the number of registered buffers, one per block
+     *
+     * @return size_t
+     */
+    size_t getNumRegistered() const {
+      return this->indices.size();
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "mempool.hpp"
+#include "mpmc_queue.hpp"
+
+namespace benpm {
+  /**
+   * @brief Work-stealing job system whose tasks live in per-worker memory
+   * pools
+   *
+   * Every worker owns a fixed size Chase-Lev deque and a pool. A task spawned
+   * on a worker is allocated, closure included, from that worker's pool with
+   * no locking, and pushed onto the bottom of its deque; the worker pops from
+   * the bottom and idle workers steal from the top. Whoever runs a task frees
+   * it: the owning worker directly, any other thread through the pool's
+   * lock-free remote free, which the owner reclaims on its next chunk switch.
+   * Tasks spawned from other threads go through a shared injection queue.
+   *
+   * When a worker's deque is full, the task runs inline instead, which bounds
+   * the deque without ever blocking.
+   *
+   * Workers that find nothing to do, and threads in wait, retry a few times
+   * and then sleep on a condition variable until a task is spawned or
+   * finishes, so an idle scheduler uses no CPU.
+   *
+   * @tparam Pool The memory pool type of each worker
+   * @tparam dequeSize Capacity of each worker's deque. Must be a power of 2!
+   */
+  template <class Pool = MemPool<>, size_t dequeSize = 4096>
+  class TaskScheduler {
+  private:  // ------------------------------------------------------------
+    static_assert(dequeSize > 0 && (dequeSize & (dequeSize - 1)) == 0, "dequeSize must be a power of 2");
+
+    // Type erased task header, followed by the closure
+    struct Task {
+      void (*run)(Task*);
+      void (*destroy)(Task*, bool local);
+    };
+
+    template <class F>
+    struct TaskImpl : Task {
+      F f;
+
+      template <class G>
+      explicit TaskImpl(G&& g) : Task{&TaskImpl::runImpl, &TaskImpl::destroyImpl}, f(std::forward<G>(g)) {}
+
+      static void runImpl(Task* t) { static_cast<TaskImpl*>(t)->f(); }
+      static void destroyImpl(Task* t, bool local) {
+        TaskImpl* self = static_cast<TaskImpl*>(t);
+        Pool* pool = Pool::ownerOf(self);
+        if (local) {
+          pool->free(self);
+        } else {
+          pool->freeRemote(self);
+        }
+      }
+    };
+
+    // Chase-Lev work-stealing deque of fixed capacity. Only the owner pushes
+    // and pops at the bottom; any thread steals from the top
+    class Deque {
+    private:
+      alignas(cacheLineSize) std::atomic<int64_t> top{0};
+      alignas(cacheLineSize) std::atomic<int64_t> bottom{0};
+      std::atomic<Task*> buffer[dequeSize];
+
+    public:
+      Deque() {
+        for (std::atomic<Task*>& slot : this->buffer) {
+          slot.store(nullptr, std::memory_order_relaxed);
+        }
+      }
+
+      // Pushes a task, returns false if the deque is full. Owner only
+      bool push(Task* task) {
+        const int64_t b = this->bottom.load(std::memory_order_relaxed);
+        const int64_t t = this->top.load(std::memory_order_acquire);
+        if (b - t >= (int64_t)dequeSize) {
+          return false;
+        }
+        this->buffer[b & (dequeSize - 1)].store(task, std::memory_order_relaxed);
+        this->bottom.store(b + 1, std::memory_order_release);
+        return true;
+      }
+
+      // Pops the most recently pushed task, or returns nullptr. Owner only
+      Task* pop() {
+        const int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+        // Publishing the claim on b and reading top must not be reordered, or
+        // a thief could take the same task
+        this->bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = this->top.load(std::memory_order_seq_cst);
+        if (t > b) {
+          this->bottom.store(b + 1, std::memory_order_relaxed);
+          return nullptr;
+        }
+        Task* task = this->buffer[b & (dequeSize - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+          // Last task, race thieves for it
+          if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            task = nullptr;
+          }
+          this->bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+      }
+
+      // Steals the least recently pushed task, or returns nullptr
+      Task* steal() {
+        int64_t t = this->top.load(std::memory_order_seq_cst);
+        const int64_t b = this->bottom.load(std::memory_order_seq_cst);
+        if (t >= b) {
+          return nullptr;
+        }
+        Task* task = this->buffer[t & (dequeSize - 1)].load(std::memory_order_acquire);
+        if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+          return nullptr;
+        }
+        return task;
+      }
+    };
+
+    // Lets threads with nothing to do sleep until notified. A thread
+    // announces itself with prepare, looks for work once more, then either
+    // cancels or parks, and park returns at once if notify ran in between.
+    // Producers call notify after publishing work, which costs a fence and a
+    // load while nobody sleeps
+    class Parking {
+    private:
+      std::mutex mutex;
+      std::condition_variable cv;
+      alignas(cacheLineSize) std::atomic<size_t> sleepers{0};
+      std::atomic<uint64_t> epoch{0};
+
+    public:
+      uint64_t prepare() {
+        this->sleepers.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return this->epoch.load(std::memory_order_acquire);
+      }
+
+      void cancel() {
+        this->sleepers.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      void park(uint64_t ticket) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cv.wait(lock, [&] { return this->epoch.load(std::memory_order_relaxed) != ticket; });
+        this->sleepers.fetch_sub(1, std::memory_order_relaxed);
+      }
+
+      void notify(bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->sleepers.load(std::memory_order_relaxed) == 0) {
+          return;
+        }
+        {
+          std::lock_guard<std::mutex> lock(this->mutex);
+          this->epoch.fetch_add(1, std::memory_order_release);
+        }
+        if (all) {
+          this->cv.notify_all();
+        } else {
+          this->cv.notify_one();
+        }
+      }
+    };
+
+    // Failed searches for a task before a thread parks
+    static constexpr int idleRounds = 64;
+
+    struct alignas(cacheLineSize) Worker {
+      TaskScheduler* scheduler;
+      Deque deque;
+      Pool pool;
+      // Tasks spawned and finished by this worker, only written by it
+      alignas(cacheLineSize) std::atomic<size_t> spawned{0};
+      std::atomic<size_t> finished{0};
+      std::thread thread;
+    };
+
+    size_t numWorkers;
+    std::unique_ptr<Worker[]> workers;
+    // Tasks spawned from outside any worker: allocated from a shared pool
+    // under a lock, and handed to the workers through a lock-free queue
+    Pool externalPool;
+    std::mutex externalMutex;
+    Pool queuePool;
+    MPMCQueue<Task*, Pool> injected;
+    // Tasks spawned and finished outside any worker
+    alignas(cacheLineSize) std::atomic<size_t> externalSpawned{0};
+    std::atomic<size_t> externalFinished{0};
+    std::atomic<bool> stopping{false};
+    // Idle workers, woken when a task is spawned
+    Parking idleWorkers;
+    // Threads in wait, woken when a task finishes
+    Parking waiters;
+
+    // The worker running on this thread, if any
+    static inline thread_local Worker* current = nullptr;
+
+    // Returns this thread's worker if it belongs to this scheduler
+    Worker* self() const {
+      return current != nullptr && current->scheduler == this ? current : nullptr;
+    }
+
+    // Runs and frees a task, counting it as finished by the given worker or,
+    // without one, externally
+    void execute(Task* task, Worker* w) {
+      task->run(task);
+      task->destroy(task, w != nullptr && Pool::ownerOf(task) == &w->pool);
+      if (w != nullptr) {
+        w->finished.store(w->finished.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      } else {
+        this->externalFinished.fetch_add(1, std::memory_order_release);
+      }
+      this->waiters.notify(true);
+    }
+
+    // Finds a task for worker w, or for an outside thread if w is nullptr:
+    // its own deque first, then the injection queue, then other workers
+    Task* find(Worker* w, size_t& victim) {
+      Task* task = nullptr;
+      if (w != nullptr && (task = w->deque.pop()) != nullptr) {
+        return task;
+      }
+      if (this->injected.dequeue(task)) {
+        return task;
+      }
+      for (size_t i = 0; i < this->numWorkers; i++) {
+        victim = (victim + 1) % this->numWorkers;
+        if (&this->workers[victim] != w && (task = this->workers[victim].deque.steal()) != nullptr) {
+          return task;
+        }
+      }
+      return nullptr;
+    }
+
+    void workerLoop(Worker* w) {
+      current = w;
+      size_t victim = (size_t)(w - this->workers.get());
+      int rounds = 0;
+      while (!this->stopping.load(std::memory_order_acquire)) {
+        if (Task* task = this->find(w, victim)) {
+          this->execute(task, w);
+          rounds = 0;
+        } else if (++rounds < idleRounds) {
+          std::this_thread::yield();
+        } else {
+          const uint64_t ticket = this->idleWorkers.prepare();
+          Task* task = nullptr;
+          if (this->stopping.load(std::memory_order_seq_cst) || (task = this->find(w, victim)) != nullptr) {
+            this->idleWorkers.cancel();
+            if (task != nullptr) {
+              this->execute(task, w);
+            }
+          } else {
+            this->idleWorkers.park(ticket);
+          }
+          rounds = 0;
+        }
+      }
+      current = nullptr;
+    }
+
+    // Returns true if every spawned task has finished. Finished counts are
+    // read before spawned counts: both only grow and a task is spawned before
+    // it finishes, so equal sums mean there was a moment with no tasks
+    bool idle() const {
+      size_t finished = this->externalFinished.load(std::memory_order_acquire);
+      for (size_t i = 0; i < this->numWorkers; i++) {
+        finished += this->workers[i].finished.load(std::memory_order_acquire);
+      }
+      size_t spawned = this->externalSpawned.load(std::memory_order_acquire);
+      for (size_t i = 0; i < this->numWorkers; i++) {
+        spawned += this->workers[i].spawned.load(std::memory_order_acquire);
+      }
+      return finished == spawned;
+    }
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Construct a scheduler and start its workers
+     *
+     * @param numWorkers Number of worker threads, at least 1
+     */
+    explicit TaskScheduler(size_t numWorkers = std::thread::hardware_concurrency())
+        : numWorkers(numWorkers > 0 ? numWorkers : 1), injected(queuePool) {
+      this->workers = std::make_unique<Worker[]>(this->numWorkers);
+      for (size_t i = 0; i < this->numWorkers; i++) {
+        this->workers[i].scheduler = this;
+      }
+      for (size_t i = 0; i < this->numWorkers; i++) {
+        this->workers[i].thread = std::thread(&TaskScheduler::workerLoop, this, &this->workers[i]);
+      }
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    /**
+     * @brief Waits for all tasks to finish, then stops the workers
+     */
+    ~TaskScheduler() {
+      this->wait();
+      this->stopping.store(true, std::memory_order_seq_cst);
+      this->idleWorkers.notify(true);
+      for (size_t i = 0; i < this->numWorkers; i++) {
+        this->workers[i].thread.join();
+      }
+    }
+
+    /**
+     * @brief Spawns a task running f(). On a worker, the task and its
+     * closure are allocated from the worker's pool without locking.
+     *
+     * @note This function is thread-safe.
+     *
+     * @tparam F Callable type, invocable with no arguments
+     * @param f The callable to run
+     */
+    template <class F>
+    void spawn(F&& f) {
+      using Impl = TaskImpl<std::decay_t<F>>;
+      if (Worker* w = this->self()) {
+        Impl* task = w->pool.template make<Impl>(std::forward<F>(f));
+        w->spawned.store(w->spawned.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        if (w->deque.push(task)) {
+          this->idleWorkers.notify(false);
+        } else {
+          this->execute(task, w);
+        }
+        return;
+      }
+      Impl* task;
+      {
+        std::lock_guard<std::mutex> lock(this->externalMutex);
+        task = this->externalPool.template make<Impl>(std::forward<F>(f));
+      }
+      this->externalSpawned.fetch_add(1, std::memory_order_release);
+      this->injected.enqueue(task);
+      this->idleWorkers.notify(false);
+    }
+
+    /**
+     * @brief Runs tasks until every spawned task has finished. Must not be
+     * called from a task.
+     *
+     * @note This function is thread-safe.
+     */
+    void wait() {
+      Worker* w = this->self();
+      size_t victim = 0;
+      int rounds = 0;
+      while (!this->idle()) {
+        if (Task* task = this->find(w, victim)) {
+          this->execute(task, w);
+          rounds = 0;
+        } else if (++rounds < idleRounds) {
+          std::this_thread::yield();
+        } else {
+          const uint64_t ticket = this->waiters.prepare();
+          Task* task = nullptr;
+          if (this->idle() || (task = this->find(w, victim)) != nullptr) {
+            this->waiters.cancel();
+            if (task != nullptr) {
+              this->execute(task, w);
+            }
+          } else {
+            this->waiters.park(ticket);
+          }
+          rounds = 0;
+        }
+      }
+    }
+
+    /**
+     * @brief Returns the number of worker threads
+     *
+     * @return size_t
+     */
+    size_t getNumWorkers() const {
+      return this->numWorkers;
+    }
+  };
+}  // namespace benpm
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <type_traits>
+
+#include "mempool.hpp"
+
+namespace benpm {
+  /**
+   * @brief Compile-time list of the types a TypedPool can hold
+   */
+  template <class... Ts>
+  struct Types {};
+
+  /**
+   * @brief Fails to compile, naming the type and its waste, when a type's size
+   * class leaves more than maxWaste bytes unused at the end of every chunk
+   */
+  template <class T, size_t wastePerChunk, size_t maxWaste>
+  struct WasteCheck {
+    static_assert(wastePerChunk <= maxWaste, "Size class wastes more than maxWaste bytes per chunk");
+    static constexpr bool value = true;
+  };
+
+  template <class TypeList, size_t chunkSize = 8192, size_t chunksPerBlock = 32, size_t maxWaste = chunkSize / 8>
+  class TypedPool;
+
+  /**
+   * @brief Memory pool for a set of types known at compile time
+   *
+   * Types are grouped into size classes at compile time, one per distinct
+   * object size, so every slot is exactly as large as its objects and needs no
+   * padding, beyond the tag header in front of each slot if MEMPOOL_TYPE_TAGS
+   * is defined. Each size class carves its own chunks, which therefore hold a
+   * whole number of equally sized slots. make<T>() dispatches to the class of T
+   * with a constant index, without any runtime branching.
+   *
+   * @tparam Ts The types that can be allocated
+   * @tparam chunkSize Size in bytes of chunks. Must be a power of 2!
+   * @tparam chunksPerBlock Number of chunks per allocated block. Must be a power of 2!
+   * @tparam maxWaste Maximum bytes per chunk a type's size class may leave unused
+   */
+  template <class... Ts, size_t chunkSize, size_t chunksPerBlock, size_t maxWaste>
+  class TypedPool<Types<Ts...>, chunkSize, chunksPerBlock, maxWaste> {
+  private:  // ------------------------------------------------------------
+    static_assert(sizeof...(Ts) > 0, "TypedPool needs at least one type");
+
+    static constexpr size_t numTypes = sizeof...(Ts);
+    static constexpr size_t sizes[numTypes] = {allocSize<Ts>()...};
+    static constexpr size_t aligns[numTypes] = {allocAlign<Ts>()...};
+
+    // Returns true if type i is the first in the list with its size
+    static constexpr bool firstOfSize(size_t i) {
+      for (size_t j = 0; j < i; j++) {
+        if (sizes[j] == sizes[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Returns the number of distinct sizes smaller than given size
+    static constexpr size_t countSmaller(size_t size) {
+      size_t n = 0;
+      for (size_t j = 0; j < numTypes; j++) {
+        n += firstOfSize(j) && sizes[j] < size;
+      }
+      return n;
+    }
+
+    // Returns the index of T in the type list
+    template <class T>
+    static constexpr size_t typeIndex() {
+      constexpr bool matches[numTypes] = {std::is_same<T, Ts>::value...};
+      for (size_t i = 0; i < numTypes; i++) {
+        if (matches[i]) {
+          return i;
+        }
+      }
+      return numTypes;
+    }
+
+  public:  // ------------------------------------------------------------
+    // Number of size classes, sorted by ascending slot size
+    static constexpr size_t numClasses = countSmaller(SIZE_MAX);
+
+    /**
+     * @brief Returns the size class of T
+     */
+    template <class T>
+    static constexpr size_t classOf() {
+      static_assert(typeIndex<T>() < numTypes, "Type is not in the pool's type list");
+      return countSmaller(allocSize<T>());
+    }
+
+    /**
+     * @brief Returns the size in bytes of the slots of size class c
+     */
+    static constexpr size_t classSize(size_t c) {
+      for (size_t i = 0; i < numTypes; i++) {
+        if (countSmaller(sizes[i]) == c) {
+          return sizes[i];
+        }
+      }
+      return 0;
+    }
+
+    /**
+     * @brief Returns the alignment of size class c, the largest alignment of
+     * its types. Always divides the slot size.
+     */
+    static constexpr size_t classAlign(size_t c) {
+      size_t align = 1;
+      for (size_t i = 0; i < numTypes; i++) {
+        if (countSmaller(sizes[i]) == c && aligns[i] > align) {
+          align = aligns[i];
+        }
+      }
+      return align;
+    }
+
+    /**
+     * @brief Returns the number of slots of size class c in each chunk
+     */
+    static constexpr size_t slotsPerChunk(size_t c) {
+      return MemPool<chunkSize, chunksPerBlock>::getObjectsPerChunk(classSize(c), classAlign(c));
+    }
+
+    /**
+     * @brief Returns the bytes left unused at the end of each chunk of size
+     * class c
+     */
+    static constexpr size_t wastePerChunk(size_t c) {
+      return MemPool<chunkSize, chunksPerBlock>::getChunkTail(classSize(c), classAlign(c));
+    }
+
+  private:  // ------------------------------------------------------------
+    static_assert((WasteCheck<Ts, wastePerChunk(classOf<Ts>()), maxWaste>::value && ...),
+                  "A size class wastes more than maxWaste bytes per chunk");
+
+    // One pool per size class, each only ever holding slots of one size
+    std::array<MemPool<chunkSize, chunksPerBlock>, numClasses> pools;
+
+  public:  // ------------------------------------------------------------
+    /**
+     * @brief Allocates object in its size class, returns pointer to object
+     *
+     * @tparam T The object type to allocate, must be in the type list
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return T* The allocated object
+     */
+    template <class T, class... V>
+    T* make(V&&... v) {
+      return this->pools[classOf<T>()].template make<T>(std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Allocates object in its size class, returns shared_ptr to object
+     *
+     * @tparam T The object type to allocate, must be in the type list
+     * @tparam V The argument types to pass to the constructor of T
+     * @param v The arguments to pass to the constructor of T
+     * @return std::shared_ptr<T> The allocated object
+     */
+    template <class T, class... V>
+    std::shared_ptr<T> makeShared(V&&... v) {
+      return this->pools[classOf<T>()].template makeShared<T>(std::forward<V>(v)...);
+    }
+
+    /**
+     * @brief Frees object from its size class
+     *
+     * @tparam T Object type, must be in the type list
+     * @param obj Pointer to object that was alloc'd in this pool
+     */
+    template <class T>
+    void free(T* obj) {
+      this->pools[classOf<T>()].free(obj);
+    }
+
+    /**
+     * @brief Returns the number of blocks allocated across all size classes
+     *
+     * @return size_t
+     */
+    size_t getNumBlocks() const {
+      size_t n = 0;
+      for (const auto& pool : this->pools) {
+        n += pool.getNumBlocks();
+      }
+      return n;
+    }
+  };
+}  // namespace benpm